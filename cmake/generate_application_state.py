@@ -34,6 +34,15 @@ def is_number(str):
         return True
 
 
+def to_initializer(value):
+    "A (nested) list as a C++ brace initializer"
+    if isinstance(value, list):
+        return "{" + ", ".join(to_initializer(v) for v in value) + "}"
+    if isinstance(value, bool):
+        return "true" if value else "false"
+    return str(value)
+
+
 class Parameter:
     "A parameter"
 
@@ -77,6 +86,10 @@ class ApplicationStateParameter:
                 v = f"{escape}{v}{escape}"
             self.default_value[i] = v
 
+        if self.parameter.return_type:
+            # Structs are brace-initialized, e.g., [[1, 2], 3] as {{1, 2}, 3}
+            self.default_value = [to_initializer(self.default_value)]
+
         if parameter.type == "std::string" and not isinstance(default_value, str):
             raise ValueError(f"Default value for {name} must be a string")
 
@@ -1,6 +1,7 @@
 #include "blitter_esp32.hh"
 
 #include "debug_assert.hh"
+#include "trace.hh"
 
 #include <algorithm>
 #include <cassert>
@@ -132,6 +133,8 @@ BlitterEsp32::BlitOne(const hal::BlitOperation& op, bool last)
 void
 BlitterEsp32::BlitOperations(std::span<const hal::BlitOperation> operations)
 {
+    os::trace::Scope trace_scope(os::trace::Event::kBlitOperations, operations.size());
+
     if (operations.empty())
     {
         return;
@@ -160,6 +163,8 @@ BlitterEsp32::OnTransactionDone()
 void
 BlitterEsp32::WaitForBlitsDone()
 {
+    os::trace::Scope trace_scope(os::trace::Event::kWaitForBlitsDone);
+
     if (m_pending_transactions.load() > 0)
     {
         m_transaction_done_semaphore.acquire();
@@ -1,5 +1,7 @@
 #include "jd9365_display_esp32.hh"
 
+#include "trace.hh"
+
 #include <esp_heap_caps.h>
 #include <esp_lcd_panel_ops.h>
 
@@ -52,6 +54,8 @@ DisplayJd9365::GetFrameBuffer(hal::IDisplay::Owner owner)
 void
 DisplayJd9365::Flip()
 {
+    os::trace::Scope trace_scope(os::trace::Event::kFlip);
+
     // If the last esp_lcd_panel_draw_bitmap arg is a frame buffer allocated in PSRAM,
     // then esp_lcd_panel_draw_bitmap does not make a copy but switches to this frame buffer
     esp_lcd_panel_draw_bitmap(m_panel_handle,
@@ -5,10 +5,12 @@
 #include <esp_heap_caps.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/idf_additions.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <functional>
 #include <memory>
 #include <new>
+#include <optional>
 
 namespace os
 {
@@ -26,6 +28,8 @@ struct ThreadContext
     struct Data
     {
         std::function<void()> m_thread_loop;
+        // Given by the task when its loop has returned, see WaitThreadExit()
+        SemaphoreHandle_t m_exited;
     };
 
     TaskHandle_t m_task;
@@ -75,43 +79,52 @@ SuspendThread(ThreadHandle thread)
 
 void WaitThreadExit(ThreadHandle thread);
 
+/// Free the sub-tick wakeup timer of the calling task, which no longer waits
+void ReleaseWakeupTimer();
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocEsp32Mem(auto alignment, auto flags)
+inline unsigned
+GetCoreCount()
 {
-    const size_t alloc_alignment = alignment > alignof(T) ? alignment : alignof(T);
-    void* raw_ptr = heap_caps_aligned_calloc(alloc_alignment, 1, sizeof(T), flags);
-    auto deleter = +[](T* ptr) {
-        if (ptr != nullptr)
-        {
-            ptr->~T();
-            heap_caps_free(ptr);
-        }
-    };
+    return portNUM_PROCESSORS;
+}
 
-    if (raw_ptr == nullptr)
-    {
-        return mem_unique_ptr<T>(nullptr, deleter);
-    }
 
-    auto* object = new (raw_ptr) T();
-    return mem_unique_ptr<T>(object, deleter);
+inline std::optional<uint32_t>
+GetStackHighWaterMark(ThreadHandle thread)
+{
+    // In bytes on ESP-IDF
+    return uxTaskGetStackHighWaterMark(thread->m_task);
 }
 
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocFastMem(unsigned alignment)
+inline void*
+AllocFastMem(size_t size, size_t alignment)
 {
-    return AllocEsp32Mem<T>(alignment, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    return heap_caps_aligned_calloc(alignment, 1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 }
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocSlowMem(unsigned alignment)
+inline void*
+AllocSlowMem(size_t size, size_t alignment)
+{
+    return heap_caps_aligned_calloc(alignment, 1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+}
+
+inline void
+FreeMem(void* ptr)
+{
+    heap_caps_free(ptr);
+}
+
+inline size_t
+GetFreeFastMem()
+{
+    return heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+inline size_t
+GetFreeSlowMem()
 {
-    return AllocEsp32Mem<T>(alignment, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 }
 
 } // namespace detail
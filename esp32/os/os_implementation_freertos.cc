@@ -1,6 +1,7 @@
 #include "base_thread.hh"
 #include "time.hh"
 
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/idf_additions.h>
 #include <freertos/task.h>
@@ -10,8 +11,10 @@ using namespace os;
 void
 os::detail::WaitThreadExit(ThreadHandle thread)
 {
+    xSemaphoreTake(thread->m_private_data->m_exited, portMAX_DELAY);
     vTaskDeleteWithCaps(thread->m_task);
 
+    vSemaphoreDelete(thread->m_private_data->m_exited);
     delete thread->m_private_data;
     delete thread;
 }
@@ -35,9 +38,21 @@ os::detail::StartThread(const char* name,
     out->m_private_data = new ThreadContext::Data;
     out->m_task = nullptr;
     out->m_private_data->m_thread_loop = thread_loop;
+    out->m_private_data->m_exited = xSemaphoreCreateBinary();
 
     xTaskCreatePinnedToCore(
-        [](void* arg) { static_cast<ThreadHandle>(arg)->m_private_data->m_thread_loop(); },
+        [](void* arg) {
+            auto data = static_cast<ThreadHandle>(arg)->m_private_data;
+
+            data->m_thread_loop();
+
+            // From the task itself, since it no longer waits
+            ReleaseWakeupTimer();
+            xSemaphoreGive(data->m_exited);
+
+            // FreeRTOS tasks must not return. Deleted by WaitThreadExit()
+            vTaskSuspend(nullptr);
+        },
         name,
         stack_size,
         out,
@@ -62,6 +77,12 @@ os::GetTimeStamp()
     return milliseconds(ms_count);
 }
 
+microseconds
+os::GetTimeStampUs()
+{
+    return microseconds(esp_timer_get_time());
+}
+
 void
 os::Sleep(milliseconds delay)
 {
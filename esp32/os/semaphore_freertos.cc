@@ -1,18 +1,136 @@
+#include "os_implementation.hh"
 #include "semaphore.hh"
 
+#include <atomic>
 #include <cassert>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <new>
+#include <utility>
 
 using namespace os;
 
+namespace
+{
+
+/*
+ * Aborts a sub-tick wait of a task on time, with a hardware timer. One per task, since a
+ * task waits for one semaphore at a time. Created on the first sub-tick wait of the
+ * task. FreeRTOS runs no thread_local destructors, so threads release it when their
+ * loop returns, see detail::ReleaseWakeupTimer().
+ */
+class WakeupTimer
+{
+public:
+    static WakeupTimer* ForCurrentTask()
+    {
+        if (!t_wakeup)
+        {
+            auto wakeup = new (std::nothrow) WakeupTimer();
+
+            if (wakeup && wakeup->m_timer && wakeup->m_done)
+            {
+                t_wakeup = wakeup;
+            }
+            else
+            {
+                delete wakeup;
+            }
+        }
+
+        return t_wakeup;
+    }
+
+    static void ReleaseForCurrentTask()
+    {
+        delete std::exchange(t_wakeup, nullptr);
+    }
+
+    // Abort the wait of the current task after @a time. False if the timer couldn't start
+    bool Arm(microseconds time)
+    {
+        m_waiter = xTaskGetCurrentTaskHandle();
+        m_armed = true;
+        if (esp_timer_start_once(m_timer, time.count()) != ESP_OK)
+        {
+            m_armed = false;
+            return false;
+        }
+
+        return true;
+    }
+
+    void Disarm()
+    {
+        if (m_armed.exchange(false) && esp_timer_stop(m_timer) == ESP_OK)
+        {
+            // Stopped before it fired
+            return;
+        }
+
+        // The callback runs or is about to: Block until it's done, so that it can't
+        // abort some later wait. Its abort may hit this take, so take again
+        while (xSemaphoreTake(m_done, portMAX_DELAY) != pdTRUE)
+        {
+        }
+    }
+
+private:
+    WakeupTimer()
+    {
+        esp_timer_create_args_t args = {};
+
+        args.callback = [](void* arg) { static_cast<WakeupTimer*>(arg)->OnTimeout(); };
+        args.arg = this;
+        args.name = "sem_wakeup";
+        if (esp_timer_create(&args, &m_timer) != ESP_OK)
+        {
+            m_timer = nullptr;
+        }
+        m_done = xSemaphoreCreateBinary();
+    }
+
+    ~WakeupTimer()
+    {
+        if (m_timer)
+        {
+            esp_timer_delete(m_timer);
+        }
+        if (m_done)
+        {
+            vSemaphoreDelete(m_done);
+        }
+    }
+
+    void OnTimeout()
+    {
+        if (m_armed.exchange(false))
+        {
+            xTaskAbortDelay(m_waiter);
+        }
+        xSemaphoreGive(m_done);
+    }
+
+    static inline thread_local WakeupTimer* t_wakeup = nullptr;
+
+    esp_timer_handle_t m_timer {nullptr};
+    SemaphoreHandle_t m_done {nullptr};
+    TaskHandle_t m_waiter {nullptr};
+    std::atomic_bool m_armed {false};
+};
+
+} // namespace
+
 namespace os
 {
 struct Impl
 {
-    Impl(auto least_max_value, auto desired)
+    Impl()
     {
-        m_sem = xSemaphoreCreateCounting(least_max_value, desired);
+        // Waiting threads only, so more than the number of tasks
+        m_sem = xSemaphoreCreateCounting(kMaxWaiters, 0);
     }
 
     ~Impl()
@@ -20,63 +138,78 @@ struct Impl
         vSemaphoreDelete(m_sem);
     }
 
+    static constexpr UBaseType_t kMaxWaiters = 0x7fff;
+
     SemaphoreHandle_t m_sem;
 };
 
 } // namespace os
 
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::counting_semaphore(ptrdiff_t desired) noexcept
+void
+detail::ReleaseWakeupTimer()
+{
+    WakeupTimer::ReleaseForCurrentTask();
+}
+
+detail::KernelSemaphore::KernelSemaphore()
+    : m_impl(std::make_unique<Impl>())
 {
-    m_impl = std::make_unique<Impl>(least_max_value, desired);
 }
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::~counting_semaphore()
+detail::KernelSemaphore::~KernelSemaphore()
 {
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::release(ptrdiff_t update) noexcept
+detail::KernelSemaphore::Give(int32_t count)
 {
-    xSemaphoreGive(m_impl->m_sem);
+    for (auto i = 0; i < count; i++)
+    {
+        xSemaphoreGive(m_impl->m_sem);
+    }
 }
 
-template <ptrdiff_t least_max_value>
 bool IRAM_ATTR
-counting_semaphore<least_max_value>::release_from_isr(ptrdiff_t update) noexcept
+detail::KernelSemaphore::GiveFromIsr(int32_t count)
 {
     BaseType_t woken = false;
-    xSemaphoreGiveFromISR(m_impl->m_sem, &woken);
+
+    for (auto i = 0; i < count; i++)
+    {
+        xSemaphoreGiveFromISR(m_impl->m_sem, &woken);
+    }
+
     return woken;
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::acquire() noexcept
+detail::KernelSemaphore::Take()
 {
     xSemaphoreTake(m_impl->m_sem, portMAX_DELAY);
 }
 
-template <ptrdiff_t least_max_value>
 bool
-counting_semaphore<least_max_value>::try_acquire() noexcept
+detail::KernelSemaphore::TakeFor(microseconds time)
 {
-    return xSemaphoreTake(m_impl->m_sem, 0) == pdTRUE;
-}
+    constexpr auto kTick = microseconds(portTICK_PERIOD_MS * 1000);
+    auto ticks = static_cast<TickType_t>(time / kTick);
 
-template <ptrdiff_t least_max_value>
-bool
-counting_semaphore<least_max_value>::try_acquire_for_ms(const milliseconds time)
-{
-    return xSemaphoreTake(m_impl->m_sem, time.count() / portTICK_PERIOD_MS) == pdTRUE;
-}
+    if (time % kTick == 0us)
+    {
+        return xSemaphoreTake(m_impl->m_sem, ticks) == pdTRUE;
+    }
 
-namespace os
-{
+    // Block until the tick after, and let a hardware timer abort the wait on time
+    auto wakeup = WakeupTimer::ForCurrentTask();
+    if (!wakeup || !wakeup->Arm(time))
+    {
+        // No timer: Wake up late rather than early
+        return xSemaphoreTake(m_impl->m_sem, ticks + 1) == pdTRUE;
+    }
 
-template class counting_semaphore<1>;
+    auto out = xSemaphoreTake(m_impl->m_sem, ticks + 1) == pdTRUE;
+    wakeup->Disarm();
 
+    return out;
 }
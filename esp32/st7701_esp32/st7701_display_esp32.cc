@@ -1,5 +1,7 @@
 #include "st7701_display_esp32.hh"
 
+#include "trace.hh"
+
 #include <esp_heap_caps.h>
 #include <esp_lcd_panel_ops.h>
 
@@ -50,6 +52,8 @@ DisplaySt7701::GetFrameBuffer(hal::IDisplay::Owner owner)
 void
 DisplaySt7701::Flip()
 {
+    os::trace::Scope trace_scope(os::trace::Event::kFlip);
+
     esp_lcd_panel_draw_bitmap(m_panel_handle,
                               0,
                               0,
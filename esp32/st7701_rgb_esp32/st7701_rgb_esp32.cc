@@ -1,5 +1,7 @@
 #include "st7701_rgb_esp32.hh"
 
+#include "trace.hh"
+
 #include <cstring>
 #include <driver/i2c_master.h>
 #include <driver/spi_master.h>
@@ -225,6 +227,8 @@ St7701RgbEsp32::GetFrameBuffer(hal::IDisplay::Owner owner)
 void IRAM_ATTR
 St7701RgbEsp32::Flip()
 {
+    os::trace::Scope trace_scope(os::trace::Event::kFlip);
+
     m_flip_requested = true;
     m_bounce_copy_end.acquire();
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "thread_parameters.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <unistd.h>
+
+namespace os
+{
+
+struct ThreadContext;
+
+using ThreadHandle = ThreadContext*;
+
+template <typename T>
+using mem_unique_ptr = std::unique_ptr<T, void (*)(T*)>;
+
+namespace detail
+{
+
+ThreadHandle GetCurrentThread();
+
+ThreadHandle StartThread(const char* name,
+                         ThreadCore core,
+                         ThreadPriority priority,
+                         uint32_t stack_size,
+                         const std::function<void()>& thread_loop);
+
+
+void AwakeThread(ThreadHandle thread);
+
+void SuspendThread(ThreadHandle thread);
+
+void WaitThreadExit(ThreadHandle thread);
+
+inline unsigned
+GetCoreCount()
+{
+    return static_cast<unsigned>(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+}
+
+/// The least free stack there has been, from a painted stack
+std::optional<uint32_t> GetStackHighWaterMark(ThreadHandle thread);
+
+
+inline void*
+AllocFastMem(size_t size, size_t alignment)
+{
+    void* out = nullptr;
+
+    // posix_memalign needs at least the alignment of a pointer
+    if (posix_memalign(&out, std::max(alignment, sizeof(void*)), size) != 0)
+    {
+        return nullptr;
+    }
+
+    return out;
+}
+
+inline void*
+AllocSlowMem(size_t size, size_t alignment)
+{
+    // Same on the host
+    return AllocFastMem(size, alignment);
+}
+
+inline void
+FreeMem(void* ptr)
+{
+    std::free(ptr);
+}
+
+inline size_t
+GetFreeFastMem()
+{
+    return sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+inline size_t
+GetFreeSlowMem()
+{
+    return GetFreeFastMem();
+}
+
+} // namespace detail
+
+} // namespace os
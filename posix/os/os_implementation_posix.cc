@@ -0,0 +1,210 @@
+#include "os_implementation.hh"
+#include "painted_stack.hh"
+#include "semaphore.hh"
+#include "time.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <utility>
+
+
+namespace
+{
+thread_local os::ThreadHandle g_current_thread = nullptr;
+
+uint64_t
+MonotonicNs()
+{
+    timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+uint64_t
+TimeSinceStartNs()
+{
+    static auto at_start = MonotonicNs();
+
+    return MonotonicNs() - at_start;
+}
+
+// Set on the attributes, so that the thread never runs on the wrong CPU
+void
+SetAffinity(pthread_attr_t& attr, os::ThreadCore core)
+{
+    auto cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    // Several ThreadCores share a CPU if the host has fewer
+    CPU_ZERO(&set);
+    CPU_SET(std::to_underlying(core) % std::max(cpus, 1L), &set);
+    pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+}
+
+#if defined(MAELIR_POSIX_SCHED_FIFO)
+void
+SetPriority(pthread_attr_t& attr, os::ThreadPriority priority)
+{
+    sched_param param {};
+
+    // Low priorities, above regular SCHED_OTHER threads but below the system ones
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + std::to_underlying(priority);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+}
+#endif
+
+} // namespace
+
+
+using namespace os;
+
+namespace os
+{
+struct ThreadContext
+{
+    os::binary_semaphore m_suspend_semaphore {0};
+    pthread_t m_thread;
+    std::function<void()> m_thread_loop;
+    uint32_t m_stack_size;
+    detail::PaintedStack m_stack;
+};
+
+} // namespace os
+
+namespace
+{
+
+void*
+ThreadEntry(void* arg)
+{
+    g_current_thread = static_cast<os::ThreadHandle>(arg);
+    g_current_thread->m_stack.Paint(g_current_thread->m_stack_size);
+    g_current_thread->m_thread_loop();
+
+    return nullptr;
+}
+
+} // namespace
+
+
+os::ThreadHandle
+os::detail::GetCurrentThread()
+{
+    return g_current_thread;
+}
+
+void
+os::detail::WaitThreadExit(ThreadHandle thread)
+{
+    pthread_join(thread->m_thread, nullptr);
+
+    delete thread;
+}
+
+ThreadHandle
+os::detail::StartThread(const char* name,
+                        ThreadCore core,
+                        ThreadPriority priority [[maybe_unused]],
+                        uint32_t stack_size,
+                        const std::function<void()>& thread_loop)
+{
+    auto out = new ThreadContext;
+    out->m_thread_loop = thread_loop;
+    out->m_stack_size = stack_size;
+
+    // The stack size is for the ESP32, so keep the (larger) default stack here
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    SetAffinity(attr, core);
+#if defined(MAELIR_POSIX_SCHED_FIFO)
+    SetPriority(attr, priority);
+#endif
+
+    auto rv = pthread_create(&out->m_thread, &attr, ThreadEntry, out);
+#if defined(MAELIR_POSIX_SCHED_FIFO)
+    if (rv == EPERM)
+    {
+        printf("SCHED_FIFO not permitted, running with the default policy\n");
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rv = pthread_create(&out->m_thread, &attr, ThreadEntry, out);
+    }
+#endif
+    pthread_attr_destroy(&attr);
+
+    if (rv != 0)
+    {
+        printf("Can't start thread %s: %s\n", name, strerror(rv));
+        abort();
+    }
+
+    // Linux thread names are limited to 15 characters
+    char short_name[16] {};
+    snprintf(short_name, sizeof(short_name), "%s", name);
+    pthread_setname_np(out->m_thread, short_name);
+
+    return out;
+}
+
+std::optional<uint32_t>
+os::detail::GetStackHighWaterMark(ThreadHandle thread)
+{
+    return thread->m_stack.GetHighWaterMark();
+}
+
+
+void
+os::detail::AwakeThread(ThreadHandle thread)
+{
+    thread->m_suspend_semaphore.release();
+}
+
+void
+os::detail::SuspendThread(ThreadHandle thread)
+{
+    auto current_thread = GetCurrentThread();
+    assert(current_thread == thread);
+
+    thread->m_suspend_semaphore.acquire();
+}
+
+
+milliseconds
+os::GetTimeStamp()
+{
+    return milliseconds(static_cast<uint32_t>(TimeSinceStartNs() / 1'000'000));
+}
+
+microseconds
+os::GetTimeStampUs()
+{
+    return microseconds(TimeSinceStartNs() / 1000);
+}
+
+uint32_t
+os::GetTimeStampRaw()
+{
+    return GetTimeStamp().count();
+}
+
+void
+os::Sleep(milliseconds delay)
+{
+    timespec ts {static_cast<time_t>(delay.count() / 1000),
+                 static_cast<long>(delay.count() % 1000) * 1'000'000};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+    {
+    }
+}
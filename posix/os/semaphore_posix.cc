@@ -0,0 +1,131 @@
+#include "semaphore.hh"
+
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace os;
+
+namespace
+{
+
+long
+Futex(std::atomic<int32_t>* word, int op, int32_t value, const timespec* deadline)
+{
+    return syscall(SYS_futex,
+                   reinterpret_cast<int32_t*>(word),
+                   op | FUTEX_PRIVATE_FLAG,
+                   value,
+                   deadline,
+                   nullptr,
+                   FUTEX_BITSET_MATCH_ANY);
+}
+
+} // namespace
+
+namespace os
+{
+/*
+ * The count of given wakeups is the futex word. Waiters sleep in the kernel while it is
+ * zero, and gives only make a system call when someone is waiting.
+ */
+struct Impl
+{
+
+    bool TryTake()
+    {
+        auto value = m_value.load(std::memory_order_relaxed);
+
+        while (value > 0)
+        {
+            if (m_value.compare_exchange_weak(
+                    value, value - 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Wait for a release, or until the absolute CLOCK_MONOTONIC @a deadline
+    bool Take(const timespec* deadline)
+    {
+        while (!TryTake())
+        {
+            m_waiters.fetch_add(1, std::memory_order_seq_cst);
+            auto rv = Futex(&m_value, FUTEX_WAIT_BITSET, 0, deadline);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+            if (rv != 0 && errno == ETIMEDOUT)
+            {
+                return TryTake();
+            }
+        }
+
+        return true;
+    }
+
+    void Give(int32_t count)
+    {
+        // Sequentially consistent with the waiter count, so that either the waiter
+        // sees the new value, or the wake sees the waiter
+        m_value.fetch_add(count, std::memory_order_seq_cst);
+
+        if (m_waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            Futex(&m_value, FUTEX_WAKE, count, nullptr);
+        }
+    }
+
+    std::atomic<int32_t> m_value {0};
+    std::atomic<int32_t> m_waiters {0};
+};
+
+} // namespace os
+
+
+detail::KernelSemaphore::KernelSemaphore()
+    : m_impl(std::make_unique<Impl>())
+{
+}
+
+detail::KernelSemaphore::~KernelSemaphore()
+{
+}
+
+void
+detail::KernelSemaphore::Give(int32_t count)
+{
+    m_impl->Give(count);
+}
+
+bool
+detail::KernelSemaphore::GiveFromIsr(int32_t count)
+{
+    Give(count);
+
+    return false;
+}
+
+void
+detail::KernelSemaphore::Take()
+{
+    m_impl->Take(nullptr);
+}
+
+bool
+detail::KernelSemaphore::TakeFor(microseconds time)
+{
+    timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    auto ns = deadline.tv_nsec + static_cast<int64_t>(time.count() % 1'000'000) * 1000;
+    deadline.tv_sec += time.count() / 1'000'000 + ns / 1'000'000'000;
+    deadline.tv_nsec = ns % 1'000'000'000;
+
+    return m_impl->Take(&deadline);
+}
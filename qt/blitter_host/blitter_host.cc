@@ -2,6 +2,7 @@
 
 #include "hal/i_display.hh"
 #include "painter.hh"
+#include "trace.hh"
 
 #include <cassert>
 #include <utility>
@@ -101,6 +102,8 @@ BlitterHost::BlitOne(const hal::BlitOperation& op)
 void
 BlitterHost::BlitOperations(std::span<const hal::BlitOperation> operations)
 {
+    os::trace::Scope trace_scope(os::trace::Event::kBlitOperations, operations.size());
+
     for (const auto& op : operations)
     {
         const int32_t dst_pic_w = (op.dst_stride > 0)
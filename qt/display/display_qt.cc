@@ -1,5 +1,7 @@
 #include "display_qt.hh"
 
+#include "trace.hh"
+
 #include <QPainter>
 
 DisplayQt::DisplayQt(QGraphicsScene* scene)
@@ -25,6 +27,8 @@ DisplayQt::GetFrameBuffer(hal::IDisplay::Owner owner)
 void
 DisplayQt::Flip()
 {
+    os::trace::Scope trace_scope(os::trace::Event::kFlip);
+
     emit DoFlip();
 }
 
@@ -2,10 +2,13 @@
 
 #include "thread_parameters.hh"
 
+#include <algorithm>
 #include <cstdlib>
 #include <functional>
 #include <memory>
 #include <new>
+#include <optional>
+#include <thread>
 
 namespace os
 {
@@ -35,37 +38,55 @@ void SuspendThread(ThreadHandle thread);
 
 void WaitThreadExit(ThreadHandle thread);
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocFastMem(unsigned alignment [[maybe_unused]])
+inline unsigned
+GetCoreCount()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/// The least free stack there has been, from a painted stack
+std::optional<uint32_t> GetStackHighWaterMark(ThreadHandle thread);
+
+
+inline void*
+AllocFastMem(size_t size, size_t alignment)
 {
-    const size_t alloc_alignment = alignment > alignof(T) ? alignment : alignof(T);
-    auto deleter = +[](T* ptr) {
-        if (ptr != nullptr)
-        {
-            ptr->~T();
-            std::free(ptr);
-        }
-    };
-
-    void* raw_ptr = nullptr;
-    if (posix_memalign(&raw_ptr, alloc_alignment, sizeof(T)) != 0)
+    void* out = nullptr;
+
+    // posix_memalign needs at least the alignment of a pointer
+    if (posix_memalign(&out, std::max(alignment, sizeof(void*)), size) != 0)
     {
-        return mem_unique_ptr<T>(nullptr, deleter);
+        return nullptr;
     }
 
-    auto* object = new (raw_ptr) T();
-    return mem_unique_ptr<T>(object, deleter);
+    return out;
 }
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocSlowMem(unsigned alignment)
+inline void*
+AllocSlowMem(size_t size, size_t alignment)
 {
-    // Same on Qt
-    return detail::AllocFastMem<T>(alignment);
+    // Same on the Qt
+    return AllocFastMem(size, alignment);
 }
 
+inline void
+FreeMem(void* ptr)
+{
+    std::free(ptr);
+}
+
+inline size_t
+GetFreeFastMem()
+{
+    // Not known on Qt
+    return 0;
+}
+
+inline size_t
+GetFreeSlowMem()
+{
+    return GetFreeFastMem();
+}
 
 } // namespace detail
 
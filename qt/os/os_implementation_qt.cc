@@ -1,4 +1,5 @@
 #include "os_implementation.hh"
+#include "painted_stack.hh"
 #include "semaphore.hh"
 #include "time.hh"
 
@@ -9,8 +10,17 @@
 namespace
 {
 QThreadStorage<os::ThreadHandle> g_current_thread;
+
+auto
+TimeSinceStart()
+{
+    static auto at_start = std::chrono::steady_clock::now();
+
+    return std::chrono::steady_clock::now() - at_start;
 }
 
+} // namespace
+
 
 using namespace os;
 
@@ -20,6 +30,7 @@ struct ThreadContext
 {
     os::binary_semaphore m_suspend_semaphore {0};
     QThread* m_thread;
+    detail::PaintedStack m_stack;
 };
 
 } // namespace os
@@ -48,12 +59,13 @@ ThreadHandle
 os::detail::StartThread(const char* name,
                         ThreadCore,
                         ThreadPriority,
-                        uint32_t,
+                        uint32_t stack_size,
                         const std::function<void()>& thread_loop)
 {
     auto out = new ThreadContext;
-    out->m_thread = QThread::create([thread_loop, out]() {
+    out->m_thread = QThread::create([thread_loop, out, stack_size]() {
         g_current_thread.setLocalData(out);
+        out->m_stack.Paint(stack_size);
         thread_loop();
     });
 
@@ -63,6 +75,12 @@ os::detail::StartThread(const char* name,
     return out;
 }
 
+std::optional<uint32_t>
+os::detail::GetStackHighWaterMark(ThreadHandle thread)
+{
+    return thread->m_stack.GetHighWaterMark();
+}
+
 
 void
 os::detail::AwakeThread(ThreadHandle thread)
@@ -83,10 +101,13 @@ os::detail::SuspendThread(ThreadHandle thread)
 milliseconds
 os::GetTimeStamp()
 {
-    static auto at_start = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<milliseconds>(TimeSinceStart());
+}
 
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::high_resolution_clock::now() - at_start);
+microseconds
+os::GetTimeStampUs()
+{
+    return std::chrono::duration_cast<microseconds>(TimeSinceStart());
 }
 
 uint32_t
@@ -1,6 +1,8 @@
 #include "semaphore.hh"
 
 #include <QSemaphore>
+#include <algorithm>
+#include <limits>
 
 using namespace os;
 
@@ -8,68 +10,48 @@ namespace os
 {
 struct Impl
 {
-    Impl(int desired)
-        : m_sem(desired)
-    {
-    }
-
-    QSemaphore m_sem;
+    QSemaphore m_sem {0};
 };
 
 } // namespace os
 
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::counting_semaphore(ptrdiff_t desired) noexcept
+detail::KernelSemaphore::KernelSemaphore()
+    : m_impl(std::make_unique<Impl>())
 {
-    m_impl = std::make_unique<Impl>(desired);
 }
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::~counting_semaphore()
+detail::KernelSemaphore::~KernelSemaphore()
 {
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::release(ptrdiff_t update) noexcept
+detail::KernelSemaphore::Give(int32_t count)
 {
-    m_impl->m_sem.release(update);
+    m_impl->m_sem.release(count);
 }
 
-template <ptrdiff_t least_max_value>
 bool
-counting_semaphore<least_max_value>::release_from_isr(ptrdiff_t update) noexcept
+detail::KernelSemaphore::GiveFromIsr(int32_t count)
 {
-    release(update);
+    Give(count);
 
     return false;
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::acquire() noexcept
+detail::KernelSemaphore::Take()
 {
     m_impl->m_sem.acquire();
 }
 
-template <ptrdiff_t least_max_value>
-bool
-counting_semaphore<least_max_value>::try_acquire() noexcept
-{
-    return m_impl->m_sem.tryAcquire();
-}
-
-template <ptrdiff_t least_max_value>
 bool
-counting_semaphore<least_max_value>::try_acquire_for_ms(const milliseconds time)
+detail::KernelSemaphore::TakeFor(microseconds time)
 {
-    return m_impl->m_sem.tryAcquire(1, time.count());
-}
-
-namespace os
-{
-
-template class counting_semaphore<1>;
+    // QSemaphore has millisecond resolution, so round up to not wake up too early. A
+    // negative timeout waits forever, and it takes an int
+    auto timeout = std::clamp<milliseconds::rep>(
+        std::chrono::ceil<milliseconds>(time).count(), 0, std::numeric_limits<int>::max());
 
+    return m_impl->m_sem.tryAcquire(1, static_cast<int>(timeout));
 }
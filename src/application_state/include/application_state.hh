@@ -12,6 +12,8 @@
 #include <etl/vector.h>
 #include <mutex>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 
 using ParameterBitset = etl::bitset<AS::kLastIndex + 1, uint32_t>;
 
@@ -21,6 +23,18 @@ constexpr auto kMaxApplicationStateListeners = 32;
 namespace AS::storage
 {
 
+/// The value type of parameter @a T
+template <typename T>
+using ValueType = std::remove_cvref_t<decltype(std::declval<T&>().template GetRef<T>())>;
+
+/// True if @a T is read without the state mutex, see NonAtomic
+template <typename T>
+consteval bool
+IsLockFree()
+{
+    return T::IsAtomic() || std::is_trivially_copyable_v<ValueType<T>>;
+}
+
 template <class... T>
 struct partial_state : public T...
 {
@@ -74,12 +88,32 @@ public:
     public:
         friend class ApplicationState;
 
+        /// Return a copy of the global value, without locking unless T is e.g. a string
         template <typename T>
         auto Get()
         {
             return m_parent.Get<T>();
         }
 
+        /// Copy the global value to @a out, which doesn't allocate if @a out has the capacity
+        template <typename T>
+        void Get(auto& out)
+        {
+            m_parent.Read<T>([&out](const auto& value) { out = value; });
+        }
+
+        /**
+         * @brief Call @a reader with a const reference to the global value, without a copy
+         *
+         * For values like strings, @a reader runs under the state mutex: Keep it short, and
+         * don't use the state from it.
+         */
+        template <typename T>
+        void Read(const auto& reader)
+        {
+            m_parent.Read<T>(reader);
+        }
+
     protected:
         explicit ReadOnly(ApplicationState& parent)
             : m_parent(parent)
@@ -169,7 +203,9 @@ public:
             {
                 if (IsChanged<S>())
                 {
-                    callback(GetReference<S>(!m_state_index), GetReference<S>(m_state_index));
+                    auto cur = CurrentIndex<S>();
+
+                    callback(GetReference<S>(!cur), GetReference<S>(cur));
                 }
 
                 return *this;
@@ -179,33 +215,64 @@ public:
             template <typename S>
             auto Get() const
             {
-                return GetReference<S>(m_state_index);
+                return GetReference<S>(CurrentIndex<S>());
             }
 
         private:
+            using State = AS::storage::partial_state<T...>;
+
             explicit Checkout(ApplicationState& parent)
                 : m_parent(parent)
             {
                 // Lock context
                 {
-                    // Hold the lock since the GetValue might refer to a shared_ptr
                     auto lock = GetLock();
 
                     (void)std::initializer_list<int> {
-                        (m_state[0].template GetRef<T>() = parent.GetValue<T>(), 0)...};
+                        (m_generations[State::template PartialIndexOf<T>()] =
+                             parent.GetGeneration<T>(),
+                         m_state[0].template GetRef<T>() = parent.GetValue<T>(),
+                         0)...};
                 }
                 m_state[1] = m_state[0];
             }
 
+            /// Copy the global value to the other buffer, if it has been written since the last pull
+            template <typename S>
+            void PullValue(ParameterBitset& written)
+            {
+                constexpr auto index = State::template PartialIndexOf<S>();
+                auto generation = m_parent.GetGeneration<S>();
+
+                if (generation == m_generations[index])
+                {
+                    return;
+                }
+
+                m_generations[index] = generation;
+                m_state[!m_state_index[index]].template GetRef<S>() = m_parent.GetValue<S>();
+                written.set(AS::IndexOf<S>());
+            }
+
+            /// Make the pulled value current if it differs (it might have been written back)
             template <typename S>
-            void UpdateChanges(uint8_t cur, uint8_t next)
+            void UpdateChanges()
             {
-                if (GetReference<S>(cur) != GetReference<S>(next))
+                auto& cur = m_state_index[State::template PartialIndexOf<S>()];
+
+                if (GetReference<S>(cur) != GetReference<S>(!cur))
                 {
                     m_changed.set(AS::IndexOf<S>());
+                    cur = !cur;
                 }
             }
 
+            template <typename S>
+            uint8_t CurrentIndex() const
+            {
+                return m_state_index[State::template PartialIndexOf<S>()];
+            }
+
             template <typename S>
             const auto& GetReference(uint8_t index) const
             {
@@ -217,19 +284,16 @@ public:
 
             std::unique_lock<etl::mutex> GetLock() const
             {
-                if constexpr (sizeof...(T) == 1)
-                {
-                    // No mutex needed here
-                    return std::unique_lock<etl::mutex>();
-                }
-                return std::unique_lock<etl::mutex>(m_parent.m_mutex);
+                return m_parent.LockForRead<T...>();
             }
 
             ApplicationState& m_parent;
 
             // TODO:  Use local index
-            std::array<AS::storage::partial_state<T...>, 2> m_state;
-            uint8_t m_state_index {0};
+            std::array<State, 2> m_state;
+            // The current buffer of each parameter, and the generation it was pulled at
+            std::array<uint8_t, sizeof...(T)> m_state_index {};
+            std::array<uint32_t, sizeof...(T)> m_generations {};
             ParameterBitset m_changed;
         };
 
@@ -245,24 +309,34 @@ public:
         {
         }
 
+        /**
+         * @brief Update the local copy with the global state.
+         *
+         * Only the parameters which have been written since the last pull are copied and
+         * compared, so the cost follows the number of changes.
+         */
         const Checkout& Pull()
         {
+            ParameterBitset written;
+
             m_checkout.m_changed.reset();
-            const uint8_t cur = m_checkout.m_state_index;
-            const uint8_t next = !cur;
 
-            // Only do the sync with the lock held, the rest is local
+            // Only do the sync with the lock held (if any), the rest is local
             {
                 auto mutex = m_checkout.GetLock();
 
-                (void)std::initializer_list<int> {(m_checkout.m_state[next].template GetRef<T>() =
-                                                       m_checkout.m_parent.template GetValue<T>(),
-                                                   0)...};
+                (void)std::initializer_list<int> {
+                    (m_checkout.template PullValue<T>(written), 0)...};
+            }
+
+            if (written.none())
+            {
+                return m_checkout;
             }
 
             (void)std::initializer_list<int> {
-                (m_checkout.template UpdateChanges<T>(cur, next), 0)...};
-            m_checkout.m_state_index = next;
+                (written.test(AS::IndexOf<T>()) ? (m_checkout.template UpdateChanges<T>(), 0)
+                                                : 0)...};
 
             return m_checkout;
         }
@@ -402,8 +476,7 @@ public:
         explicit PartialSnapshot(ApplicationState& parent)
             : m_parent(parent)
         {
-            // Hold the lock since the GetValue might refer to a shared_ptr
-            std::lock_guard lock(m_parent.m_mutex);
+            auto lock = m_parent.LockForRead<T...>();
 
             (void)std::initializer_list<int> {
                 (m_state.template GetRef<T>() = m_parent.GetValue<T>(), 0)...};
@@ -558,24 +631,28 @@ private:
     template <typename T>
     auto Get()
     {
-        if constexpr (T::IsAtomic())
+        auto lock = LockForRead<T>();
+
+        return GetValue<T>();
+    }
+
+    template <typename T>
+    void Read(const auto& reader)
+    {
+        auto lock = LockForRead<T>();
+
+        if constexpr (AS::storage::IsLockFree<T>())
         {
-            return m_global_state.GetRef<T>().load();
+            reader(GetValue<T>());
         }
         else
         {
-            /* On return, the shared_ptr to const ensures the value stays alive even if
-             * it's written, until the reader is done with it.
-             */
-            using pointer_type = std::remove_reference_t<decltype(m_global_state.GetRef<T>())>;
-            using element_type = typename pointer_type::element_type;
-
-            std::shared_ptr<const element_type> out = m_global_state.GetRef<T>();
-
-            return out;
+            // In place, so e.g. strings are not copied
+            reader(std::as_const(m_global_state.GetRef<T>()));
         }
     }
 
+    /// Read the global value. Hold the mutex unless IsLockFree<T>()
     template <typename T>
     auto GetValue()
     {
@@ -583,9 +660,47 @@ private:
         {
             return m_global_state.GetRef<T>().load();
         }
+        else if constexpr (AS::storage::IsLockFree<T>())
+        {
+            return m_global_state.GetRef<T>().Load();
+        }
+        else
+        {
+            return m_global_state.GetRef<T>();
+        }
+    }
+
+    /// True if @a value is the global value. Hold the mutex
+    template <typename T>
+    bool IsCurrentValue(const auto& value)
+    {
+        if constexpr (AS::storage::IsLockFree<T>())
+        {
+            return value == GetValue<T>();
+        }
+        else
+        {
+            // In place, so e.g. strings are not copied
+            return value == m_global_state.GetRef<T>();
+        }
+    }
+
+    /**
+     * @brief Lock the state mutex for reading @a T, if needed.
+     *
+     * Parameters which are read lock-free are consistent each on their own, so reads of
+     * several parameters are not taken at the same instant.
+     */
+    template <typename... T>
+    std::unique_lock<etl::mutex> LockForRead()
+    {
+        if constexpr ((AS::storage::IsLockFree<T>() && ...))
+        {
+            return std::unique_lock<etl::mutex>();
+        }
         else
         {
-            return *m_global_state.GetRef<T>();
+            return std::unique_lock<etl::mutex>(m_mutex);
         }
     }
 
@@ -599,21 +714,27 @@ private:
         }
         else
         {
-            auto& ref = m_global_state.GetRef<T>();
-
-            m_global_state.GetRef<T>() = std::make_shared<std::decay_t<decltype(*ref)>>(value);
+            AS::storage::Assign(m_global_state.GetRef<T>(), value);
         }
     }
 
+    /// The number of writes of @a T, so readers can skip unchanged parameters
+    template <typename T>
+    uint32_t GetGeneration() const
+    {
+        return m_generations[AS::IndexOf<T>()].load(std::memory_order_acquire);
+    }
+
     template <typename T>
     void SetNoLock(const auto& value)
     {
-        if (value == GetValue<T>())
+        if (IsCurrentValue<T>(value))
         {
             return;
         }
 
         DoSetValue<T>(value);
+        m_generations[AS::IndexOf<T>()].fetch_add(1, std::memory_order_release);
 
         NotifyChange(AS::IndexOf<T>());
     }
@@ -621,12 +742,13 @@ private:
     template <typename T>
     void SetNoLockCollectChanged(const auto& value, ParameterBitset& changed)
     {
-        if (value == GetValue<T>())
+        if (IsCurrentValue<T>(value))
         {
             return;
         }
 
         DoSetValue<T>(value);
+        m_generations[AS::IndexOf<T>()].fetch_add(1, std::memory_order_release);
 
         changed.set(AS::IndexOf<T>());
     }
@@ -638,6 +760,8 @@ private:
     void NotifyMultipleChanges(const ParameterBitset& changed);
 
     AS::storage::state m_global_state;
+    // Bumped on each write, per parameter
+    std::array<std::atomic<uint32_t>, AS::kLastIndex + 1> m_generations {};
 
     etl::mutex m_mutex;
 
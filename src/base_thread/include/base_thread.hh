@@ -1,40 +1,114 @@
 #pragma once
 
+#include "coroutine.hh"
+#include "event_flags.hh"
+#include "mailbox.hh"
 #include "os/thread.hh"
 #include "semaphore.hh"
+#include "thread_profile.hh"
 #include "time.hh"
 #include "timer_manager.hh"
 
 #include <atomic>
 #include <optional>
 
+class KernelSimulator;
+
 namespace os
 {
 
-class BaseThread : public OsThread
+/**
+ * @brief A thread with an event loop and timers.
+ *
+ * Other threads send messages to it through a Mailbox member constructed with
+ * GetSemaphore(), which is drained from OnActivation().
+ *
+ * The thread can also run coroutines (os::Task), which co_await SleepFor() or a
+ * CoroutineEvent constructed with GetCoroutineScheduler(). They are resumed from the
+ * thread loop, so small polling tasks need no thread of their own. Start them from
+ * OnStartup(), since they run until their first co_await when created.
+ *
+ * A thread with several event sources can give each an EventSource on
+ * GetEventFlags(), and override OnActivation(EventMask) to only service the sources
+ * which have fired.
+ *
+ * With MAELIR_PROFILING, the activations, the time in OnActivation() and in the timer
+ * callbacks, and the wakeup latency are recorded, see GetThreadStatistics().
+ *
+ * @tparam TimerManagerType the timer manager of the thread, see BasicTimerManager. Its
+ * clock sets the resolution of the timers and of the wait for the next wakeup.
+ */
+template <typename TimerManagerType>
+class BasicBaseThread : public OsThread
 {
 public:
     // For unit tests
     friend class ::ThreadFixture;
+    friend class ::KernelSimulator;
+
+    using duration = typename TimerManagerType::duration;
+    using TimerCallback = typename TimerManagerType::Callback;
 
-    BaseThread()
+    BasicBaseThread()
         : m_timer_manager(m_semaphore)
     {
+#if defined(MAELIR_PROFILING)
+        m_timer_manager.SetProfile(m_profile);
+#endif
     }
 
-    virtual ~BaseThread() override
+    virtual ~BasicBaseThread() override
     {
         Stop();
     }
 
     void Awake() final
     {
+        m_profile.OnWakeup();
         m_semaphore.release();
     }
 
+    /**
+     * @brief Defer a job to this thread from another thread.
+     *
+     * Lock-free, and the thread is awoken once for a batch of posted jobs. The job
+     * runs until it returns std::nullopt, so it can also be a periodic timer.
+     *
+     * @param job the function to execute
+     * @param timeout the delay from when the thread picks up the job
+     *
+     * @return false if the inbox is full
+     */
+    bool Post(TimerCallback job, duration timeout = 0ms)
+    {
+        m_profile.OnWakeup();
+        return m_timer_manager.Post(timeout, std::move(job));
+    }
+
+    /// Same as Post(), but from an ISR
+    bool PostFromIsr(TimerCallback job, duration timeout = 0ms)
+    {
+        m_profile.OnWakeup();
+        return m_timer_manager.PostFromIsr(timeout, std::move(job));
+    }
+
 protected:
-    /// @brief the thread has been awoken
-    virtual std::optional<milliseconds> OnActivation() = 0;
+    /**
+     * @brief the thread has been awoken
+     *
+     * @param events the bits of the EventSources which have fired since the last
+     * activation. Timers, Awake() and notifications of GetSemaphore() set no bit.
+     */
+    virtual std::optional<milliseconds> OnActivation(EventMask events [[maybe_unused]])
+    {
+        return OnActivation();
+    }
+
+    /// @brief the thread has been awoken, for threads which don't use GetEventFlags()
+    virtual std::optional<milliseconds> OnActivation()
+    {
+        return std::nullopt;
+    }
 
     /**
      * @brief Start a timer in this thread.
@@ -44,31 +118,80 @@ protected:
      * @return a handle to the started timer.
      */
     TimerHandle StartTimer(
-        milliseconds timeout, std::function<std::optional<milliseconds>()> on_timeout = []() {
-            return std::optional<milliseconds>();
+        duration timeout, TimerCallback on_timeout = []() {
+            return std::optional<duration>();
         })
     {
-        return m_timer_manager.StartTimer(timeout, on_timeout);
+        return m_timer_manager.StartTimer(timeout, std::move(on_timeout));
+    }
+
+    /**
+     * @brief Start a timer in this thread, which may fire up to @a slack late.
+     *
+     * The slack lets the timer manager coalesce timers, to reduce the number of wakeups.
+     *
+     * @param timeout the earliest timeout of the timer
+     * @param slack how much later the timer may fire
+     * @param on_timeout the function to call on timeout
+     * @return a handle to the started timer.
+     */
+    TimerHandle StartTimer(
+        duration timeout, duration slack, TimerCallback on_timeout = []() {
+            return std::optional<duration>();
+        })
+    {
+        return m_timer_manager.StartTimer(timeout, slack, std::move(on_timeout));
     }
 
     /**
      * @brief Defer the execution of a function.
      *
+     * Like timers, deferred jobs are kept in the timer manager pool and never allocate.
+     *
      * @param deferred_job the function to execute
      *
      * @return a handle to the started job
      */
-    TimerHandle Defer(std::function<std::optional<milliseconds>()> deferred_job)
+    TimerHandle Defer(TimerCallback deferred_job)
+    {
+        return m_timer_manager.StartTimer(0ms, std::move(deferred_job));
+    }
+
+    /**
+     * @brief Suspend the calling coroutine, which must run on this thread.
+     *
+     * @param timeout the time to sleep
+     *
+     * @return an awaitable for co_await, which yields false without sleeping if the
+     * timer pool is full
+     */
+    [[nodiscard]] SleepAwaiter<TimerManagerType> SleepFor(duration timeout)
     {
-        return m_timer_manager.StartTimer(0ms, deferred_job);
+        return SleepAwaiter<TimerManagerType>(m_timer_manager, m_coroutines, timeout);
     }
 
-    auto& GetSemaphore()
+    /// The notifier which awakes the thread, for mailboxes and listeners
+    IEventNotifier& GetSemaphore()
     {
+#if defined(MAELIR_PROFILING)
+        return m_wakeup;
+#else
         return m_semaphore;
+#endif
+    }
+
+    CoroutineScheduler& GetCoroutineScheduler()
+    {
+        return m_coroutines;
+    }
+
+    /// The event bits of the thread, for EventSources
+    EventFlags& GetEventFlags()
+    {
+        return m_event_flags;
     }
 
-    os::TimerManager& GetTimerManager()
+    TimerManagerType& GetTimerManager()
     {
         return m_timer_manager;
     }
@@ -81,7 +204,8 @@ protected:
 private:
     struct Impl;
 
-    std::optional<milliseconds> SelectWakeup(auto a, auto b) const
+    std::optional<duration> SelectWakeup(std::optional<duration> a,
+                                         std::optional<duration> b) const
     {
         if (a && b)
         {
@@ -101,9 +225,19 @@ private:
     }
 
     // Accessible for unit tests
-    std::optional<milliseconds> RunLoop()
+    std::optional<duration> RunLoop()
     {
-        auto thread_wakeup = OnActivation();
+        trace::Scope trace_scope(trace::Event::kActivation);
+
+        m_profile.BeginActivation();
+        m_coroutines.RunReady();
+
+        std::optional<milliseconds> thread_wakeup;
+        {
+            ProfileScope scope(&m_profile, &ThreadProfile::AddActivationTime);
+
+            thread_wakeup = OnActivation(m_event_flags.Take());
+        }
         auto timer_expiration = m_timer_manager.Expire();
 
         return SelectWakeup(thread_wakeup, timer_expiration);
@@ -111,6 +245,7 @@ private:
 
     void ThreadLoop() final
     {
+        m_profile.SetName(GetName());
         OnStartup();
 
         while (IsRunning())
@@ -129,8 +264,17 @@ private:
     }
 
     binary_semaphore m_semaphore {0};
+    [[no_unique_address]] ThreadProfile m_profile;
+#if defined(MAELIR_PROFILING)
+    ProfiledNotifier<binary_semaphore> m_wakeup {m_semaphore, m_profile};
+#endif
     Impl* m_impl {nullptr}; // Raw pointer to allow forward declaration
-    TimerManager m_timer_manager;
+    TimerManagerType m_timer_manager;
+    CoroutineScheduler m_coroutines {GetSemaphore()};
+    EventFlags m_event_flags {GetSemaphore()};
 };
 
+/// The regular thread, with a small timer manager
+using BaseThread = BasicBaseThread<TimerManager>;
+
 } // namespace os
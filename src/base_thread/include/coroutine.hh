@@ -0,0 +1,383 @@
+#pragma once
+
+#include "debug_assert.hh"
+#include "event_notifier.hh"
+#include "timer_manager.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <etl/vector.h>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace os
+{
+
+constexpr auto kMaxSuspendedCoroutines = 16;
+
+class CoroutineEvent;
+
+/**
+ * @brief A coroutine which runs on a BaseThread, see BasicBaseThread::SleepFor() and
+ * CoroutineEvent.
+ *
+ * The coroutine starts immediately and runs until its first co_await. Destroying the
+ * task destroys the coroutine, also when it is suspended.
+ *
+ * @code
+ * os::Task GpsThread::ReadLoop()
+ * {
+ *     while (true)
+ *     {
+ *         co_await m_data_ready;
+ *         ParseData();
+ *         co_await SleepFor(100ms);
+ *     }
+ * }
+ * @endcode
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        // Kept until the task is destroyed, to allow Done()
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    Task() = default;
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~Task()
+    {
+        Reset();
+    }
+
+    /// Return true if the coroutine has returned (or there is none)
+    bool Done() const
+    {
+        return !m_handle || m_handle.done();
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : m_handle(handle)
+    {
+    }
+
+    void Reset()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+/**
+ * @brief Resumes the coroutines of a thread, from the thread itself.
+ *
+ * Coroutines are never resumed from a timer callback or another thread. They are
+ * marked ready, the thread is awoken, and the thread resumes them on the next round
+ * of its loop.
+ */
+class CoroutineScheduler
+{
+public:
+    friend class CoroutineEvent;
+
+    /// @param wakeup the notifier which awakes the thread, typically its semaphore
+    explicit CoroutineScheduler(IEventNotifier& wakeup)
+        : m_wakeup(wakeup)
+    {
+    }
+
+    CoroutineScheduler(const CoroutineScheduler&) = delete;
+    CoroutineScheduler& operator=(const CoroutineScheduler&) = delete;
+
+    /// Resume @a handle on the next round. Thread only
+    void Schedule(std::coroutine_handle<> handle)
+    {
+        debug_assert(!m_ready.full());
+
+        m_ready.push_back(handle);
+        m_wakeup.Notify();
+    }
+
+    /// Forget a coroutine which is destroyed while suspended. Thread only
+    void Forget(std::coroutine_handle<> handle)
+    {
+        m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), handle), m_ready.end());
+    }
+
+    /// Resume all coroutines which are ready. Thread only
+    void RunReady();
+
+private:
+    void Wait(CoroutineEvent* event)
+    {
+        debug_assert(!m_waiting.full());
+
+        m_waiting.push_back(event);
+    }
+
+    void StopWaiting(CoroutineEvent* event)
+    {
+        m_waiting.erase(std::remove(m_waiting.begin(), m_waiting.end(), event), m_waiting.end());
+    }
+
+    IEventNotifier& m_wakeup;
+    etl::vector<CoroutineEvent*, kMaxSuspendedCoroutines> m_waiting;
+    etl::vector<std::coroutine_handle<>, kMaxSuspendedCoroutines> m_ready;
+};
+
+/**
+ * @brief An event which a coroutine can co_await.
+ *
+ * Notify() can be called from any thread or ISR, so the event can be passed wherever
+ * an IEventNotifier is taken, e.g., to a Mailbox or to ApplicationState::AttachListener().
+ * Signals are not counted: several notifications before the co_await resume it once.
+ * Only one coroutine at a time can wait for an event.
+ */
+class CoroutineEvent : public IEventNotifier
+{
+public:
+    friend class CoroutineScheduler;
+
+    explicit CoroutineEvent(CoroutineScheduler& scheduler)
+        : m_scheduler(scheduler)
+    {
+    }
+
+    CoroutineEvent(const CoroutineEvent&) = delete;
+    CoroutineEvent& operator=(const CoroutineEvent&) = delete;
+
+    ~CoroutineEvent() override
+    {
+        m_scheduler.StopWaiting(this);
+    }
+
+    void Notify() final
+    {
+        m_signalled.store(true, std::memory_order_release);
+        m_scheduler.m_wakeup.Notify();
+    }
+
+    void NotifyFromIsr() final
+    {
+        m_signalled.store(true, std::memory_order_release);
+        m_scheduler.m_wakeup.NotifyFromIsr();
+    }
+
+    auto operator co_await()
+    {
+        class Awaiter
+        {
+        public:
+            explicit Awaiter(CoroutineEvent& event)
+                : m_event(event)
+            {
+            }
+
+            Awaiter(const Awaiter&) = delete;
+            Awaiter& operator=(const Awaiter&) = delete;
+
+            ~Awaiter()
+            {
+                if (m_handle)
+                {
+                    // Destroyed while suspended
+                    m_event.m_scheduler.StopWaiting(&m_event);
+                    m_event.m_scheduler.Forget(m_handle);
+                    m_event.m_waiter = nullptr;
+                }
+            }
+
+            bool await_ready()
+            {
+                return m_event.m_signalled.exchange(false, std::memory_order_acquire);
+            }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                debug_assert(!m_event.m_waiter);
+
+                m_handle = handle;
+                m_event.m_waiter = handle;
+                m_event.m_scheduler.Wait(&m_event);
+            }
+
+            void await_resume()
+            {
+                m_handle = nullptr;
+            }
+
+        private:
+            CoroutineEvent& m_event;
+            std::coroutine_handle<> m_handle;
+        };
+
+        return Awaiter(*this);
+    }
+
+private:
+    CoroutineScheduler& m_scheduler;
+    std::coroutine_handle<> m_waiter;
+    std::atomic_bool m_signalled {false};
+};
+
+/**
+ * @brief Suspend a coroutine for a time, see BasicBaseThread::SleepFor().
+ *
+ * The timer is cancelled if the coroutine is destroyed while sleeping.
+ */
+template <typename TimerManagerType>
+class SleepAwaiter
+{
+public:
+    using duration = typename TimerManagerType::duration;
+
+    SleepAwaiter(TimerManagerType& timer_manager,
+                 CoroutineScheduler& scheduler,
+                 duration timeout)
+        : m_timer_manager(timer_manager)
+        , m_scheduler(scheduler)
+        , m_timeout(timeout)
+    {
+    }
+
+    SleepAwaiter(const SleepAwaiter&) = delete;
+    SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+
+    ~SleepAwaiter()
+    {
+        if (m_handle)
+        {
+            // Destroyed after the timeout, but before being resumed
+            m_scheduler.Forget(m_handle);
+        }
+    }
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_timer = m_timer_manager.StartTimer(m_timeout, [this]() {
+            m_scheduler.Schedule(m_handle);
+            return std::optional<duration>();
+        });
+        if (m_timer.IsExpired())
+        {
+            // The timer pool is full, so resume immediately
+            return false;
+        }
+
+        m_handle = handle;
+        m_slept = true;
+
+        return true;
+    }
+
+    /// @return false if the coroutine didn't sleep, because the timer pool is full
+    bool await_resume()
+    {
+        m_handle = nullptr;
+
+        return m_slept;
+    }
+
+private:
+    TimerManagerType& m_timer_manager;
+    CoroutineScheduler& m_scheduler;
+    const duration m_timeout;
+    std::coroutine_handle<> m_handle;
+    TimerHandle m_timer;
+    bool m_slept {false};
+};
+
+
+inline void
+CoroutineScheduler::RunReady()
+{
+    for (auto it = m_waiting.begin(); it != m_waiting.end();)
+    {
+        auto event = *it;
+
+        if (m_ready.full())
+        {
+            // The rest stay signalled, and are picked up in the next round
+            m_wakeup.Notify();
+            break;
+        }
+
+        if (event->m_signalled.exchange(false, std::memory_order_acquire))
+        {
+            m_ready.push_back(std::exchange(event->m_waiter, nullptr));
+            it = m_waiting.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // Coroutines which become ready while running are resumed in the next round
+    auto count = m_ready.size();
+    for (auto i = 0u; i < count && !m_ready.empty(); i++)
+    {
+        auto handle = m_ready.front();
+
+        m_ready.erase(m_ready.begin());
+        handle.resume();
+    }
+}
+
+} // namespace os
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "debug_assert.hh"
+#include "event_notifier.hh"
+
+#include <atomic>
+#include <cstdint>
+
+namespace os
+{
+
+/// One bit per EventSource
+using EventMask = uint32_t;
+
+constexpr auto kMaxEventSources = 32;
+
+/**
+ * @brief A set of event bits, which awakes a thread when a bit is set.
+ *
+ * Each source of events (a CAN bus, the GPS, a touch IRQ, ...) gets its own bit
+ * through an EventSource, so the woken thread can tell which sources to service. The
+ * thread is only notified when a bit goes from clear to set, so repeated events from
+ * one source before the thread runs wake it once.
+ *
+ * A BaseThread has one, see BasicBaseThread::GetEventFlags().
+ */
+class EventFlags
+{
+public:
+    /// @param wakeup the notifier which awakes the thread, typically its semaphore
+    explicit EventFlags(IEventNotifier& wakeup)
+        : m_wakeup(wakeup)
+    {
+    }
+
+    EventFlags(const EventFlags&) = delete;
+    EventFlags& operator=(const EventFlags&) = delete;
+
+    /// Set the bits in @a mask, from any thread
+    void Set(EventMask mask)
+    {
+        if ((m_flags.fetch_or(mask, std::memory_order_release) & mask) != mask)
+        {
+            m_wakeup.Notify();
+        }
+    }
+
+    /// Same as Set(), but from an ISR
+    void SetFromIsr(EventMask mask)
+    {
+        if ((m_flags.fetch_or(mask, std::memory_order_release) & mask) != mask)
+        {
+            m_wakeup.NotifyFromIsr();
+        }
+    }
+
+    /// Return and clear the bits which are set. Thread only
+    EventMask Take()
+    {
+        return m_flags.exchange(0, std::memory_order_acquire);
+    }
+
+private:
+    IEventNotifier& m_wakeup;
+    std::atomic<EventMask> m_flags {0};
+};
+
+/**
+ * @brief The notifier of one event source, which sets its bit in an EventFlags.
+ *
+ * Pass it wherever an IEventNotifier is taken, e.g., to ICan::Start(), a Mailbox or
+ * ApplicationState::AttachListener().
+ *
+ * @code
+ * class CanThread : public os::BaseThread
+ * {
+ *     enum Source { kCan, kState };
+ *
+ *     std::optional<milliseconds> OnActivation(os::EventMask events) final
+ *     {
+ *         if (events & os::EventSource::Bit(kCan))
+ *         {
+ *             // Drain the CAN frames
+ *         }
+ *         ...
+ *     }
+ *
+ *     os::EventSource m_can_event {GetEventFlags(), kCan};
+ *     os::EventSource m_state_event {GetEventFlags(), kState};
+ * };
+ * @endcode
+ */
+class EventSource : public IEventNotifier
+{
+public:
+    EventSource(EventFlags& flags, unsigned bit)
+        : m_flags(flags)
+        , m_mask(Bit(bit))
+    {
+        debug_assert(bit < kMaxEventSources);
+    }
+
+    static constexpr EventMask Bit(unsigned bit)
+    {
+        return EventMask(1) << bit;
+    }
+
+    EventMask Mask() const
+    {
+        return m_mask;
+    }
+
+    void Notify() final
+    {
+        m_flags.Set(m_mask);
+    }
+
+    void NotifyFromIsr() final
+    {
+        m_flags.SetFromIsr(m_mask);
+    }
+
+private:
+    EventFlags& m_flags;
+    const EventMask m_mask;
+};
+
+} // namespace os
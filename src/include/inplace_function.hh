@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace os
+{
+
+template <typename Signature, size_t Capacity = 4 * sizeof(void*)>
+class InplaceFunction;
+
+/**
+ * @brief A std::function replacement which stores the callable inline.
+ *
+ * Callables larger than @a Capacity are rejected at compile time, so constructing,
+ * copying and destroying an InplaceFunction never touches the heap.
+ */
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+public:
+    InplaceFunction() = default;
+
+    InplaceFunction(std::nullptr_t)
+    {
+    }
+
+    template <typename F>
+        requires(!std::is_same_v<std::decay_t<F>, InplaceFunction> &&
+                 std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+    InplaceFunction(F&& f)
+    {
+        using Callable = std::decay_t<F>;
+
+        static_assert(sizeof(Callable) <= Capacity, "Callable too large for InplaceFunction");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t),
+                      "Callable alignment not supported");
+        static_assert(std::is_copy_constructible_v<Callable>, "Callable must be copyable");
+
+        new (m_storage) Callable(std::forward<F>(f));
+        m_ops = &kOps<Callable>;
+    }
+
+    InplaceFunction(const InplaceFunction& other)
+    {
+        if (other.m_ops)
+        {
+            other.m_ops->copy(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+        }
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept
+    {
+        if (other.m_ops)
+        {
+            other.m_ops->move(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.Reset();
+        }
+    }
+
+    ~InplaceFunction()
+    {
+        Reset();
+    }
+
+    InplaceFunction& operator=(const InplaceFunction& other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            if (other.m_ops)
+            {
+                other.m_ops->copy(m_storage, other.m_storage);
+                m_ops = other.m_ops;
+            }
+        }
+
+        return *this;
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            if (other.m_ops)
+            {
+                other.m_ops->move(m_storage, other.m_storage);
+                m_ops = other.m_ops;
+                other.Reset();
+            }
+        }
+
+        return *this;
+    }
+
+    InplaceFunction& operator=(std::nullptr_t)
+    {
+        Reset();
+
+        return *this;
+    }
+
+    R operator()(Args... args) const
+    {
+        return m_ops->invoke(const_cast<std::byte*>(m_storage), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+private:
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*copy)(void* dst, const void* src);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Callable>
+    static constexpr Ops kOps {
+        [](void* storage, Args&&... args) -> R {
+            return std::invoke_r<R>(*static_cast<Callable*>(storage), std::forward<Args>(args)...);
+        },
+        [](void* dst, const void* src) { new (dst) Callable(*static_cast<const Callable*>(src)); },
+        [](void* dst, void* src) {
+            new (dst) Callable(std::move(*static_cast<Callable*>(src)));
+        },
+        [](void* storage) { static_cast<Callable*>(storage)->~Callable(); },
+    };
+
+    void Reset()
+    {
+        if (m_ops)
+        {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) std::byte m_storage[Capacity];
+    const Ops* m_ops {nullptr};
+};
+
+} // namespace os
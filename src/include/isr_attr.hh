@@ -0,0 +1,12 @@
+#pragma once
+
+/*
+ * Functions called from ISRs. On the ESP32 they are placed in IRAM, so that they also
+ * run while the flash cache is disabled. Nothing on the host.
+ */
+#if __has_include(<esp_attr.h>)
+#include <esp_attr.h>
+#define MAELIR_ISR_ATTR IRAM_ATTR
+#else
+#define MAELIR_ISR_ATTR
+#endif
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "event_notifier.hh"
+#include "mpsc_queue.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace os
+{
+
+/**
+ * @brief Typed message queue into a thread, e.g., a BaseThread.
+ *
+ * Any thread or ISR can post messages, and the receiving thread drains them in order
+ * from OnActivation(). The notifier (typically the thread semaphore) is only signalled
+ * when the mailbox goes from drained to pending, so a burst of messages wakes the
+ * thread once. Messages are handed to the receiver in place, without copies.
+ *
+ * @code
+ * class GpsThread : public os::BaseThread
+ * {
+ *     os::Mailbox<GpsData, 8> m_positions {GetSemaphore()};
+ * };
+ * @endcode
+ *
+ * @tparam T the message type
+ * @tparam Capacity the number of messages, must be a power of two
+ */
+template <typename T, size_t Capacity>
+class Mailbox
+{
+public:
+    explicit Mailbox(IEventNotifier& notifier)
+        : m_notifier(notifier)
+    {
+    }
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    /// Post a message from any thread. Return false if the mailbox is full
+    template <typename... Args>
+    bool Post(Args&&... args)
+    {
+        if (!m_queue.TryPush(std::forward<Args>(args)...))
+        {
+            return false;
+        }
+
+        if (!m_signalled.exchange(true, std::memory_order_acq_rel))
+        {
+            m_notifier.Notify();
+        }
+
+        return true;
+    }
+
+    /// Same as Post(), but from an ISR
+    template <typename... Args>
+    bool PostFromIsr(Args&&... args)
+    {
+        if (!m_queue.TryPush(std::forward<Args>(args)...))
+        {
+            return false;
+        }
+
+        if (!m_signalled.exchange(true, std::memory_order_acq_rel))
+        {
+            m_notifier.NotifyFromIsr();
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Handle pending messages, oldest first. Receiving thread only.
+     *
+     * Messages left because of @a max are kept for the next call, and the notifier is
+     * signalled again to come back for them. A drain with @a max 0 doesn't signal.
+     *
+     * @param on_message called with a reference to each message
+     * @param max the maximum number of messages to handle
+     *
+     * @return the number of messages handled
+     */
+    template <typename F>
+    size_t Drain(F&& on_message, size_t max = Capacity)
+    {
+        // Clear before draining, so that posts after this point signal again. The
+        // exchange makes all messages posted before the last signal visible
+        m_signalled.exchange(false, std::memory_order_acq_rel);
+
+        size_t count = 0;
+        while (count < max)
+        {
+            auto message = m_queue.Front();
+            if (!message)
+            {
+                break;
+            }
+
+            on_message(*message);
+            m_queue.Pop();
+            count++;
+        }
+
+        if (count > 0 && count == max && !Empty() &&
+            !m_signalled.exchange(true, std::memory_order_acq_rel))
+        {
+            m_notifier.Notify();
+        }
+
+        return count;
+    }
+
+    /// Receiving thread only
+    bool Empty()
+    {
+        return m_queue.Front() == nullptr;
+    }
+
+private:
+    MpscQueue<T, Capacity> m_queue;
+    IEventNotifier& m_notifier;
+    std::atomic_bool m_signalled {false};
+};
+
+} // namespace os
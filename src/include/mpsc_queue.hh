@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace os
+{
+
+/**
+ * @brief Bounded lock-free multi-producer, single-consumer queue.
+ *
+ * Each cell carries a sequence number telling whether it's free for the producer at
+ * that position, or filled for the consumer. Producers only claim a position with a
+ * compare-and-swap and never wait for each other, so TryPush() is safe from ISRs. A
+ * producer preempted between claiming and publishing a cell only delays the consumer.
+ *
+ * @tparam T the element type
+ * @tparam Capacity the number of elements, must be a power of two
+ */
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+public:
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+    MpscQueue()
+    {
+        for (auto i = 0u; i < Capacity; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue()
+    {
+        while (Front())
+        {
+            Pop();
+        }
+    }
+
+    /// Add an element from any thread or ISR. Return false if the queue is full
+    template <typename... Args>
+    bool TryPush(Args&&... args)
+    {
+        auto position = m_enqueue_position.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true)
+        {
+            cell = &m_cells[position & kMask];
+
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (diff == 0)
+            {
+                if (m_enqueue_position.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Not yet consumed since the last lap
+                return false;
+            }
+            else
+            {
+                // Claimed by another producer
+                position = m_enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->storage) T(std::forward<Args>(args)...);
+        cell->sequence.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /// The oldest element, or nullptr if there is none. Consumer only
+    T* Front()
+    {
+        auto& cell = m_cells[m_dequeue_position & kMask];
+
+        if (cell.sequence.load(std::memory_order_acquire) != m_dequeue_position + 1)
+        {
+            return nullptr;
+        }
+
+        return std::launder(reinterpret_cast<T*>(cell.storage));
+    }
+
+    /// Remove the element returned by Front(). Consumer only
+    void Pop()
+    {
+        auto& cell = m_cells[m_dequeue_position & kMask];
+
+        std::launder(reinterpret_cast<T*>(cell.storage))->~T();
+        cell.sequence.store(m_dequeue_position + Capacity, std::memory_order_release);
+        m_dequeue_position++;
+    }
+
+    /// Remove and return the oldest element, if any. Consumer only
+    std::optional<T> TryPop()
+    {
+        auto front = Front();
+
+        if (!front)
+        {
+            return std::nullopt;
+        }
+
+        std::optional<T> out(std::move(*front));
+        Pop();
+
+        return out;
+    }
+
+private:
+    static constexpr size_t kMask = Capacity - 1;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    std::array<Cell, Capacity> m_cells;
+    std::atomic<size_t> m_enqueue_position {0};
+    size_t m_dequeue_position {0};
+};
+
+} // namespace os
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace os::detail
+{
+
+/**
+ * @brief The stack high-water mark for the host backends, where the kernel doesn't track it.
+ *
+ * The thread paints its unused stack with a pattern when it starts. The stack is then
+ * scanned from the bottom for the first word which no longer has the pattern, which is
+ * the deepest the thread has been. Only Linux can tell the stack bounds, so elsewhere
+ * there is no high-water mark.
+ *
+ * The host stack is much larger than the ESP32 one, so only @a stack_size times
+ * kHostStackFactor is painted. The host also uses more stack for the same code (64-bit
+ * pointers, less optimization), so the use is an upper bound of the target one.
+ */
+class PaintedStack
+{
+public:
+    static constexpr auto kHostStackFactor = 4;
+
+    /// Paint the stack of the calling thread, below the caller
+    [[gnu::noinline]] __attribute__((no_sanitize("address", "thread"))) void
+    Paint(uint32_t stack_size)
+    {
+#if defined(__linux__)
+        pthread_attr_t attr;
+        void* stack_low;
+        size_t size;
+
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        {
+            return;
+        }
+        pthread_attr_getstack(&attr, &stack_low, &size);
+        pthread_attr_destroy(&attr);
+
+        auto frame = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) - kMargin;
+        auto low = std::max(reinterpret_cast<uintptr_t>(stack_low),
+                            frame - size_t {stack_size} * kHostStackFactor);
+
+        auto words = (frame - low) / sizeof(uint32_t);
+
+        m_stack_size = stack_size;
+        m_low = reinterpret_cast<volatile uint32_t*>(low & ~uintptr_t {3});
+
+        // volatile, so the compiler doesn't turn it into a (sanitized) memset
+        for (auto i = 0u; i < words; i++)
+        {
+            m_low[i] = kPattern;
+        }
+        m_words.store(words, std::memory_order_release);
+#endif
+    }
+
+    /**
+     * @brief Return the least free space there has been in the first @a stack_size bytes
+     * of the stack, or std::nullopt if the stack isn't painted. Any thread
+     */
+    __attribute__((no_sanitize("address", "thread"))) std::optional<uint32_t>
+    GetHighWaterMark() const
+    {
+        auto words = m_words.load(std::memory_order_acquire);
+
+        if (words == 0)
+        {
+            return std::nullopt;
+        }
+
+        auto untouched = 0u;
+        while (untouched < words && m_low[untouched] == kPattern)
+        {
+            untouched++;
+        }
+
+        // The margin above the painted part counts as used
+        auto used = (words - untouched) * sizeof(uint32_t) + kMargin;
+
+        return used >= m_stack_size ? 0 : m_stack_size - used;
+    }
+
+private:
+    static constexpr uint32_t kPattern = 0xa5a5a5a5;
+    // Room for the frame of Paint()
+    static constexpr size_t kMargin = 256;
+
+    volatile uint32_t* m_low {nullptr};
+    std::atomic<size_t> m_words {0};
+    uint32_t m_stack_size {0};
+};
+
+} // namespace os::detail
@@ -1,45 +1,191 @@
 #pragma once
 
 #include "event_notifier.hh"
+#include "isr_attr.hh"
 #include "time.hh"
+#include "trace.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
-#include <semaphore>
+#include <ratio>
 
 namespace os
 {
 struct Impl;
 
-// From std::semaphore
-template <ptrdiff_t least_max_value = INT32_MAX>
-class counting_semaphore : public IEventNotifier
+namespace detail
 {
-    std::unique_ptr<Impl> m_impl;
 
+/**
+ * @brief The kernel semaphore behind a counting_semaphore, implemented by each backend.
+ *
+ * It's only used when a thread has to wait, so Give() is only called for threads which
+ * are blocked (or about to block) in Take() or TakeFor().
+ */
+class KernelSemaphore
+{
 public:
-    explicit counting_semaphore(ptrdiff_t desired) noexcept;
+    KernelSemaphore();
+
+    ~KernelSemaphore();
+
+    KernelSemaphore(const KernelSemaphore&) = delete;
+    KernelSemaphore& operator=(const KernelSemaphore&) = delete;
+
+    /// Let @a count waiting threads continue
+    void Give(int32_t count);
+
+    // Return true if a higher prio task was awoken
+    bool GiveFromIsr(int32_t count);
+
+    void Take();
+
+    /// Return false on timeout. Waits shorter than the OS tick are not rounded down
+    bool TakeFor(microseconds time);
+
+private:
+    std::unique_ptr<Impl> m_impl;
+};
+
+/*
+ * The release of a counting_semaphore, outside of the template so that it can be placed
+ * in IRAM for release_from_isr(): GCC ignores section attributes on template instances.
+ */
 
-    ~counting_semaphore();
+/// Add @a update to @a count, up to @a max. Return the number of waiting threads to awake
+MAELIR_ISR_ATTR inline int32_t
+Release(std::atomic<int32_t>& count, ptrdiff_t update, int32_t max)
+{
+    auto current = count.load(std::memory_order_relaxed);
+    int32_t next;
+
+    do
+    {
+        next = static_cast<int32_t>(std::min<int64_t>(int64_t {current} + update, max));
+    } while (!count.compare_exchange_weak(
+        current, next, std::memory_order_release, std::memory_order_relaxed));
+
+    return current < 0 ? std::min(-current, next - current) : 0;
+}
+
+/// Return true if a higher prio task was awoken
+MAELIR_ISR_ATTR inline bool
+ReleaseFromIsr(std::atomic<int32_t>& count, ptrdiff_t update, int32_t max, KernelSemaphore& kernel)
+{
+    if (auto waiters = Release(count, update, max))
+    {
+        return kernel.GiveFromIsr(waiters);
+    }
+
+    return false;
+}
+
+} // namespace detail
+
+/*
+ * From std::semaphore. The count is kept in an atomic, which is negative when threads
+ * wait, so the kernel is only entered when a thread has to block or be awoken.
+ */
+template <ptrdiff_t least_max_value = INT32_MAX>
+class counting_semaphore : public IEventNotifier
+{
+public:
+    explicit counting_semaphore(ptrdiff_t desired) noexcept
+        : m_count(static_cast<int32_t>(std::clamp<ptrdiff_t>(desired, 0, max())))
+    {
+    }
 
     counting_semaphore(const counting_semaphore&) = delete;
     counting_semaphore& operator=(const counting_semaphore&) = delete;
 
-    void release(ptrdiff_t __update = 1) noexcept;
+    static constexpr ptrdiff_t max() noexcept
+    {
+        return std::min<ptrdiff_t>(least_max_value, INT32_MAX);
+    }
 
-    // Return true if a higher prio task was awoken
-    bool release_from_isr(ptrdiff_t __update = 1) noexcept;
+    /// Add @a update to the count, up to max()
+    void release(ptrdiff_t update = 1) noexcept
+    {
+        trace::Instant(trace::Event::kSemaphoreRelease, trace::IdOf(this));
 
-    void acquire() noexcept;
+        if (auto waiters = detail::Release(m_count, update, max()))
+        {
+            m_kernel.Give(waiters);
+        }
+    }
 
-    bool try_acquire() noexcept;
+    // Return true if a higher prio task was awoken. Inlined into the ISR, see
+    // detail::ReleaseFromIsr()
+    [[gnu::always_inline]] bool release_from_isr(ptrdiff_t update = 1) noexcept
+    {
+        trace::InstantFromIsr(trace::Event::kSemaphoreRelease, trace::IdOf(this));
+
+        return detail::ReleaseFromIsr(m_count, update, max(), m_kernel);
+    }
+
+    void acquire() noexcept
+    {
+        if (m_count.fetch_sub(1, std::memory_order_acquire) > 0)
+        {
+            return;
+        }
+
+        trace::Scope trace_scope(trace::Event::kSemaphoreAcquire, trace::IdOf(this));
+        m_kernel.Take();
+    }
+
+    bool try_acquire() noexcept
+    {
+        auto count = m_count.load(std::memory_order_relaxed);
+
+        while (count > 0)
+        {
+            if (m_count.compare_exchange_weak(
+                    count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
 
     template <typename _Rep, typename _Period>
     bool try_acquire_for(const std::chrono::duration<_Rep, _Period>& rtime)
     {
-        return try_acquire_for_ms(rtime);
+        if constexpr (std::ratio_less_v<_Period, std::milli>)
+        {
+            return try_acquire_for_us(std::chrono::ceil<microseconds>(rtime));
+        }
+        else
+        {
+            return try_acquire_for_ms(rtime);
+        }
     }
 
-    bool try_acquire_for_ms(const milliseconds rtime);
+    bool try_acquire_for_ms(const milliseconds rtime)
+    {
+        return try_acquire_for_us(rtime);
+    }
+
+    // Waits shorter than the OS tick are not rounded down to a poll
+    bool try_acquire_for_us(const microseconds rtime)
+    {
+        if (m_count.fetch_sub(1, std::memory_order_acquire) > 0)
+        {
+            return true;
+        }
+
+        trace::Scope trace_scope(trace::Event::kSemaphoreAcquire, trace::IdOf(this));
+        if (m_kernel.TakeFor(rtime))
+        {
+            return true;
+        }
+
+        return CancelWait();
+    }
 
     void Notify() final
     {
@@ -50,6 +196,30 @@ public:
     {
         release_from_isr();
     }
+
+private:
+    // The wait has timed out, so stop waiting unless a release has already counted this thread
+    bool CancelWait()
+    {
+        auto count = m_count.load(std::memory_order_relaxed);
+
+        while (count < 0)
+        {
+            if (m_count.compare_exchange_weak(
+                    count, count + 1, std::memory_order_relaxed, std::memory_order_relaxed))
+            {
+                return false;
+            }
+        }
+
+        // Raced with a release, which gives (or has given) the kernel semaphore to this thread
+        m_kernel.Take();
+
+        return true;
+    }
+
+    std::atomic<int32_t> m_count;
+    detail::KernelSemaphore m_kernel;
 };
 
 using binary_semaphore = counting_semaphore<1>;
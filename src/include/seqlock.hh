@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace os
+{
+
+/**
+ * @brief A value which is read lock-free, and written by one writer at a time.
+ *
+ * The value is kept in two copies, and the sequence number tells which one readers
+ * should use (a seqlock "latch"). The writer moves the readers to the other copy while
+ * updating one, so a reader never waits for a preempted writer: it only retries when a
+ * write completed a step during its read. Readers don't write to shared memory, so
+ * frequent reads from another core don't bounce any cache line.
+ *
+ * Writers must be serialized by the caller, e.g., with a mutex.
+ *
+ * @tparam T a trivially copyable type
+ */
+template <typename T>
+class Seqlock
+{
+public:
+    static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>,
+                  "Seqlock values are copied word by word");
+
+    Seqlock()
+        : Seqlock(T {})
+    {
+    }
+
+    explicit Seqlock(const T& value)
+    {
+        Write(m_copies[0], value);
+        Write(m_copies[1], value);
+    }
+
+    Seqlock(const Seqlock&) = delete;
+    Seqlock& operator=(const Seqlock&) = delete;
+
+    /// Return a consistent copy of the value, from any thread
+    T Load() const
+    {
+        Words words;
+        uint32_t sequence;
+
+        do
+        {
+            sequence = m_sequence.load(std::memory_order_acquire);
+
+            const auto& copy = m_copies[sequence & 1];
+            for (auto i = 0u; i < kWords; i++)
+            {
+                words[i] = copy[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (m_sequence.load(std::memory_order_relaxed) != sequence);
+
+        T out;
+        std::memcpy(&out, words.data(), sizeof(T));
+
+        return out;
+    }
+
+    /// Replace the value. Writers must not run concurrently
+    void Store(const T& value)
+    {
+        auto sequence = m_sequence.load(std::memory_order_relaxed);
+
+        // Readers move to the other copy while this one is written, and then back
+        m_sequence.store(sequence + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        Write(m_copies[sequence & 1], value);
+
+        m_sequence.store(sequence + 2, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        Write(m_copies[(sequence + 1) & 1], value);
+    }
+
+private:
+    static constexpr auto kWords = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    using Words = std::array<uint32_t, kWords>;
+    using Copy = std::array<std::atomic<uint32_t>, kWords>;
+
+    static void Write(Copy& copy, const T& value)
+    {
+        Words words {};
+
+        std::memcpy(words.data(), &value, sizeof(T));
+        for (auto i = 0u; i < kWords; i++)
+        {
+            copy[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint32_t> m_sequence {0};
+    std::array<Copy, 2> m_copies;
+};
+
+} // namespace os
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "event_notifier.hh"
+#include "time.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <etl/vector.h>
+#include <mutex>
+
+/*
+ * Thread profiling, enabled with -DMAELIR_PROFILING=ON in CMake (which defines
+ * MAELIR_PROFILING). When disabled, ThreadProfile is empty and every call compiles
+ * to nothing.
+ */
+
+namespace os
+{
+
+constexpr auto kMaxProfiledThreads = 16;
+
+/// Counters of one thread, see GetThreadStatistics()
+struct ThreadStatistics
+{
+    const char* name {""};
+    /// Number of rounds of the thread loop
+    uint32_t activations {0};
+    /// Time spent in OnActivation()
+    microseconds activation_time {0};
+    microseconds max_activation_time {0};
+    /// Number of timer callbacks run
+    uint32_t timer_callbacks {0};
+    /// Time spent in timer callbacks
+    microseconds timer_callback_time {0};
+    microseconds max_timer_callback_time {0};
+    /// Number of activations caused by a wakeup (not by a timeout)
+    uint32_t wakeups {0};
+    /// Time from the first Awake() or Notify() to the start of the loop round
+    microseconds wakeup_latency {0};
+    microseconds max_wakeup_latency {0};
+};
+
+#if defined(MAELIR_PROFILING)
+
+class ThreadProfile;
+
+namespace detail
+{
+
+struct ProfileRegistry
+{
+    std::mutex mutex;
+    etl::vector<ThreadProfile*, kMaxProfiledThreads> profiles;
+};
+
+inline ProfileRegistry&
+GetProfileRegistry()
+{
+    static ProfileRegistry registry;
+
+    return registry;
+}
+
+} // namespace detail
+
+/**
+ * @brief The profiling counters of a thread, registered globally while it lives.
+ *
+ * Updated by the owning thread only (apart from OnWakeup()), so reads from other
+ * threads can see a round half-way through.
+ */
+class ThreadProfile
+{
+public:
+    ThreadProfile()
+    {
+        auto& registry = detail::GetProfileRegistry();
+        std::scoped_lock lock(registry.mutex);
+
+        if (!registry.profiles.full())
+        {
+            registry.profiles.push_back(this);
+        }
+    }
+
+    ~ThreadProfile()
+    {
+        auto& registry = detail::GetProfileRegistry();
+        std::scoped_lock lock(registry.mutex);
+
+        registry.profiles.erase(
+            std::remove(registry.profiles.begin(), registry.profiles.end(), this),
+            registry.profiles.end());
+    }
+
+    ThreadProfile(const ThreadProfile&) = delete;
+    ThreadProfile& operator=(const ThreadProfile&) = delete;
+
+    void SetName(const char* name)
+    {
+        m_statistics.name = name;
+    }
+
+    /// The thread is awoken, from any thread or ISR. Only the first wakeup counts
+    void OnWakeup()
+    {
+        // Truncated, since latencies are short. 0 means no pending wakeup
+        auto now = std::max<uint32_t>(static_cast<uint32_t>(GetTimeStampUs().count()), 1);
+        uint32_t expected = 0;
+
+        m_wakeup_time.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+    }
+
+    /// A loop round starts
+    void BeginActivation()
+    {
+        auto wakeup_time = m_wakeup_time.exchange(0, std::memory_order_relaxed);
+
+        m_statistics.activations++;
+        if (wakeup_time != 0)
+        {
+            auto now = static_cast<uint32_t>(GetTimeStampUs().count());
+
+            m_statistics.wakeups++;
+            Add(m_statistics.wakeup_latency,
+                m_statistics.max_wakeup_latency,
+                microseconds(static_cast<uint32_t>(now - wakeup_time)));
+        }
+    }
+
+    void AddActivationTime(microseconds time)
+    {
+        Add(m_statistics.activation_time, m_statistics.max_activation_time, time);
+    }
+
+    void AddTimerCallbackTime(microseconds time)
+    {
+        m_statistics.timer_callbacks++;
+        Add(m_statistics.timer_callback_time, m_statistics.max_timer_callback_time, time);
+    }
+
+    const ThreadStatistics& GetStatistics() const
+    {
+        return m_statistics;
+    }
+
+private:
+    static void Add(microseconds& total, microseconds& max, microseconds time)
+    {
+        total += time;
+        max = std::max(max, time);
+    }
+
+    ThreadStatistics m_statistics;
+    std::atomic<uint32_t> m_wakeup_time {0};
+};
+
+/// Measures the time of a scope
+class ProfileScope
+{
+public:
+    ProfileScope(ThreadProfile* profile, void (ThreadProfile::*record)(microseconds))
+        : m_profile(profile)
+        , m_record(record)
+        , m_start(GetTimeStampUs())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        if (m_profile)
+        {
+            (m_profile->*m_record)(GetTimeStampUs() - m_start);
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ThreadProfile* m_profile;
+    void (ThreadProfile::*m_record)(microseconds);
+    microseconds m_start;
+};
+
+/// Forwards notifications to the thread semaphore, and records the wakeup time
+template <typename Target>
+class ProfiledNotifier : public IEventNotifier
+{
+public:
+    ProfiledNotifier(Target& target, ThreadProfile& profile)
+        : m_target(target)
+        , m_profile(profile)
+    {
+    }
+
+    void Notify() final
+    {
+        m_profile.OnWakeup();
+        m_target.Notify();
+    }
+
+    void NotifyFromIsr() final
+    {
+        m_profile.OnWakeup();
+        m_target.NotifyFromIsr();
+    }
+
+private:
+    Target& m_target;
+    ThreadProfile& m_profile;
+};
+
+/// Return a snapshot of the statistics of all threads
+inline etl::vector<ThreadStatistics, kMaxProfiledThreads>
+GetThreadStatistics()
+{
+    auto& registry = detail::GetProfileRegistry();
+    std::scoped_lock lock(registry.mutex);
+    etl::vector<ThreadStatistics, kMaxProfiledThreads> out;
+
+    for (auto profile : registry.profiles)
+    {
+        out.push_back(profile->GetStatistics());
+    }
+
+    return out;
+}
+
+#else
+
+class ThreadProfile
+{
+public:
+    void SetName(const char*)
+    {
+    }
+
+    void OnWakeup()
+    {
+    }
+
+    void BeginActivation()
+    {
+    }
+
+    void AddActivationTime(microseconds)
+    {
+    }
+
+    void AddTimerCallbackTime(microseconds)
+    {
+    }
+};
+
+class ProfileScope
+{
+public:
+    ProfileScope(ThreadProfile*, void (ThreadProfile::*)(microseconds))
+    {
+    }
+};
+
+inline etl::vector<ThreadStatistics, kMaxProfiledThreads>
+GetThreadStatistics()
+{
+    return {};
+}
+
+#endif
+
+/// Print the statistics of all threads
+inline void
+DumpThreadStatistics()
+{
+    for (const auto& s : GetThreadStatistics())
+    {
+        printf("%-16s act %6lu %8llu us (max %6llu) timers %6lu %8llu us (max %6llu) "
+               "wakeups %6lu latency %8llu us (max %6llu)\n",
+               s.name,
+               static_cast<unsigned long>(s.activations),
+               static_cast<unsigned long long>(s.activation_time.count()),
+               static_cast<unsigned long long>(s.max_activation_time.count()),
+               static_cast<unsigned long>(s.timer_callbacks),
+               static_cast<unsigned long long>(s.timer_callback_time.count()),
+               static_cast<unsigned long long>(s.max_timer_callback_time.count()),
+               static_cast<unsigned long>(s.wakeups),
+               static_cast<unsigned long long>(s.wakeup_latency.count()),
+               static_cast<unsigned long long>(s.max_wakeup_latency.count()));
+    }
+}
+
+} // namespace os
@@ -1,6 +1,10 @@
+#pragma once
+
 #include <chrono>
+#include <cstdint>
 
 using milliseconds = std::chrono::duration<uint32_t, std::milli>;
+using microseconds = std::chrono::duration<uint64_t, std::micro>;
 using seconds = std::chrono::duration<uint32_t, std::ratio<1>>;
 using namespace std::chrono_literals;
 
@@ -11,6 +15,31 @@ milliseconds GetTimeStamp();
 
 uint32_t GetTimeStampRaw();
 
+/// Monotonic 64-bit microsecond time, which doesn't wrap in practice
+microseconds GetTimeStampUs();
+
 void Sleep(milliseconds delay);
 
+/// Time base for timers, wrapping after 49 days
+struct MillisecondClock
+{
+    using duration = milliseconds;
+
+    static duration Now()
+    {
+        return GetTimeStamp();
+    }
+};
+
+/// Time base for sub-millisecond timers
+struct MicrosecondClock
+{
+    using duration = microseconds;
+
+    static duration Now()
+    {
+        return GetTimeStampUs();
+    }
+};
+
 } // namespace os
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "time.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+/*
+ * Event tracing, enabled with -DMAELIR_TRACING=ON in CMake (which defines
+ * MAELIR_TRACING). When disabled, all trace calls compile to nothing.
+ *
+ * Each thread writes to its own ring buffer, so tracing takes no locks. All buffers
+ * live in one plain struct (os::trace::TraceState), which can be read from the ESP32
+ * memory (e.g., with DumpRaw() over the console or from a core dump) and converted
+ * to Chrome JSON on the host with ExportChromeJson(). Open the JSON in Perfetto or
+ * chrome://tracing.
+ */
+
+#if !defined(MAELIR_TRACE_EVENTS)
+#define MAELIR_TRACE_EVENTS 256
+#endif
+
+namespace os::trace
+{
+
+constexpr auto kMaxTracedThreads = 12;
+constexpr auto kTraceEvents = MAELIR_TRACE_EVENTS;
+constexpr uint32_t kTraceMagic = 0x54524345; // "TRCE"
+constexpr uint32_t kTraceVersion = 1;
+
+static_assert((kTraceEvents & (kTraceEvents - 1)) == 0, "Must be a power of two");
+
+enum class Event : uint8_t
+{
+    kActivation,
+    kSemaphoreAcquire,
+    kSemaphoreRelease,
+    kTimerExpiry,
+    kSchedule,
+    kBlitOperations,
+    kWaitForBlitsDone,
+    kFlip,
+
+    kValueCount,
+};
+
+enum class Phase : uint8_t
+{
+    kBegin,
+    kEnd,
+    kInstant,
+};
+
+constexpr const char* kEventNames[] = {
+    "activation",
+    "semaphore_acquire",
+    "semaphore_release",
+    "timer_expiry",
+    "schedule",
+    "blit_operations",
+    "wait_for_blits_done",
+    "flip",
+};
+static_assert(std::size(kEventNames) == static_cast<size_t>(Event::kValueCount));
+
+struct Record
+{
+    uint32_t timestamp_us;
+    uint32_t arg;
+    Event event;
+    Phase phase;
+};
+
+struct Buffer
+{
+    char name[16];
+    // Number of records ever written, the ring index is head % kTraceEvents
+    std::atomic<uint32_t> head;
+    Record records[kTraceEvents];
+};
+
+/// The whole trace, with the same layout on the ESP32 and the host
+struct TraceState
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t events_per_buffer;
+    // Buffer 0 is shared by the ISRs
+    std::atomic<uint32_t> buffer_count;
+    Buffer buffers[kMaxTracedThreads];
+};
+
+#if defined(MAELIR_TRACING)
+
+inline TraceState g_trace_state {kTraceMagic, kTraceVersion, kTraceEvents, 1, {}};
+
+namespace detail
+{
+
+inline thread_local Buffer* t_buffer = nullptr;
+
+inline Buffer*
+GetBuffer()
+{
+    if (!t_buffer)
+    {
+        auto index = g_trace_state.buffer_count.fetch_add(1, std::memory_order_relaxed);
+
+        if (index >= kMaxTracedThreads)
+        {
+            // Out of buffers: Drop the events of this thread
+            g_trace_state.buffer_count.store(kMaxTracedThreads, std::memory_order_relaxed);
+            return nullptr;
+        }
+        t_buffer = &g_trace_state.buffers[index];
+    }
+
+    return t_buffer;
+}
+
+inline void
+Write(Buffer* buffer, Event event, Phase phase, uint32_t arg)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    auto slot = buffer->head.fetch_add(1, std::memory_order_relaxed) % kTraceEvents;
+
+    buffer->records[slot] = {
+        static_cast<uint32_t>(GetTimeStampUs().count()), arg, event, phase};
+}
+
+} // namespace detail
+
+/// Name the buffer of the calling thread
+inline void
+SetThreadName(const char* name)
+{
+    if (auto buffer = detail::GetBuffer())
+    {
+        strncpy(buffer->name, name, sizeof(buffer->name) - 1);
+    }
+}
+
+inline void
+Begin(Event event, uint32_t arg = 0)
+{
+    detail::Write(detail::GetBuffer(), event, Phase::kBegin, arg);
+}
+
+inline void
+End(Event event, uint32_t arg = 0)
+{
+    detail::Write(detail::GetBuffer(), event, Phase::kEnd, arg);
+}
+
+inline void
+Instant(Event event, uint32_t arg = 0)
+{
+    detail::Write(detail::GetBuffer(), event, Phase::kInstant, arg);
+}
+
+/// Events from ISRs go to a shared buffer, since the ISR has no thread of its own
+inline void
+InstantFromIsr(Event event, uint32_t arg = 0)
+{
+    detail::Write(&g_trace_state.buffers[0], event, Phase::kInstant, arg);
+}
+
+#else
+
+inline void
+SetThreadName(const char*)
+{
+}
+
+inline void
+Begin(Event, uint32_t = 0)
+{
+}
+
+inline void
+End(Event, uint32_t = 0)
+{
+}
+
+inline void
+Instant(Event, uint32_t = 0)
+{
+}
+
+inline void
+InstantFromIsr(Event, uint32_t = 0)
+{
+}
+
+#endif
+
+/// Trace the duration of a scope
+class Scope
+{
+public:
+    explicit Scope(Event event, uint32_t arg = 0)
+        : m_event(event)
+        , m_arg(arg)
+    {
+        Begin(m_event, m_arg);
+    }
+
+    ~Scope()
+    {
+        End(m_event, m_arg);
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const Event m_event;
+    const uint32_t m_arg;
+};
+
+/// A short id for traced objects, e.g., a semaphore
+inline uint32_t
+IdOf(const void* object)
+{
+    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(object));
+}
+
+/**
+ * @brief Write @a state as raw bytes, for ExportChromeJson() on the host.
+ *
+ * @param write called with chunks of the state, e.g., to print as hex on the console
+ */
+template <typename Writer>
+void
+DumpRaw(const TraceState& state, Writer&& write)
+{
+    write(reinterpret_cast<const uint8_t*>(&state), sizeof(state));
+}
+
+/**
+ * @brief Write the trace in the Chrome JSON format.
+ *
+ * @param state the live state, or a raw dump from DumpRaw()
+ * @param out the file to write to
+ *
+ * @return false if @a state is not a trace of this version and size
+ */
+inline bool
+ExportChromeJson(const TraceState& state, FILE* out)
+{
+    if (state.magic != kTraceMagic || state.version != kTraceVersion ||
+        state.events_per_buffer != kTraceEvents)
+    {
+        return false;
+    }
+
+    const char* separator = "";
+    auto buffer_count = std::min<uint32_t>(state.buffer_count.load(), kMaxTracedThreads);
+
+    fprintf(out, "{\"traceEvents\":[");
+    for (auto tid = 0u; tid < buffer_count; tid++)
+    {
+        const auto& buffer = state.buffers[tid];
+        auto head = buffer.head.load();
+        auto count = std::min<uint32_t>(head, kTraceEvents);
+
+        fprintf(out,
+                "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                "\"args\":{\"name\":\"%.*s\"}}",
+                separator,
+                tid,
+                static_cast<int>(sizeof(buffer.name)),
+                tid == 0 ? "isr" : buffer.name);
+        separator = ",";
+
+        // Oldest first
+        for (auto i = head - count; i != head; i++)
+        {
+            const auto& record = buffer.records[i % kTraceEvents];
+            auto event = static_cast<size_t>(record.event);
+            const char* phases[] = {"B", "E", "i"};
+
+            if (event >= std::size(kEventNames) || static_cast<size_t>(record.phase) > 2)
+            {
+                continue;
+            }
+
+            fprintf(out,
+                    ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lu,\"pid\":0,\"tid\":%u,"
+                    "\"s\":\"t\",\"args\":{\"arg\":%lu}}",
+                    kEventNames[event],
+                    phases[static_cast<size_t>(record.phase)],
+                    static_cast<unsigned long>(record.timestamp_us),
+                    tid,
+                    static_cast<unsigned long>(record.arg));
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    return true;
+}
+
+} // namespace os::trace
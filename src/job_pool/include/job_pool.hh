@@ -0,0 +1,169 @@
+#pragma once
+
+#include "inplace_function.hh"
+#include "os/thread.hh"
+#include "semaphore.hh"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <etl/deque.h>
+#include <etl/vector.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace os
+{
+
+constexpr auto kJobQueueSize = 64;
+/// ParallelFor() and Run() calls which can wait at the same time, including nested ones
+constexpr auto kMaxJobPoolWaits = 16;
+constexpr auto kMaxTasks = 32;
+
+using Job = InplaceFunction<void()>;
+
+class JobPool;
+
+/**
+ * @brief A graph of jobs with dependencies, run with JobPool::Run().
+ *
+ * A task is started when all tasks preceding it have completed. The graph can be run
+ * several times.
+ */
+class TaskGraph
+{
+public:
+    using TaskId = uint8_t;
+
+    /// Add a task, to be run after its predecessors (see Precede())
+    TaskId Add(Job job);
+
+    /// Let @a before complete before @a after is started
+    void Precede(TaskId before, TaskId after);
+
+    size_t Size() const
+    {
+        return m_tasks.size();
+    }
+
+private:
+    friend class JobPool;
+
+    struct Task
+    {
+        Job job;
+        etl::vector<TaskId, kMaxTasks> successors;
+        uint8_t predecessors {0};
+        std::atomic<uint8_t> predecessors_left {0};
+    };
+
+    etl::vector<Task, kMaxTasks> m_tasks;
+};
+
+/**
+ * @brief Pool of worker threads for splitting CPU-heavy work across cores.
+ *
+ * Each worker is pinned to its own core and has its own deque of jobs. Jobs submitted
+ * from a worker (e.g., task successors or a nested ParallelFor()) go to its own deque,
+ * which it runs newest first. Idle workers steal the oldest jobs from the others. The
+ * thread waiting for a ParallelFor() or a TaskGraph helps by running jobs until none
+ * are left, and then blocks until its work is done, so a pool without workers runs
+ * everything in the caller.
+ *
+ * Jobs must not block on each other except through the pool.
+ */
+class JobPool
+{
+public:
+    /**
+     * @brief Create the pool and start the workers
+     *
+     * @param workers the number of workers, one per core by default
+     * @param priority the priority of the workers
+     * @param stack_size the stack size of each worker
+     */
+    explicit JobPool(size_t workers = GetCoreCount(),
+                     ThreadPriority priority = ThreadPriority::kNormal,
+                     uint32_t stack_size = kDefaultStackSize);
+
+    ~JobPool();
+
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    /**
+     * @brief Run @a fn over [0, count) in chunks of @a grain, and wait for completion.
+     *
+     * @param count the number of items
+     * @param grain the number of items per job
+     * @param fn called as fn(begin, end) for each chunk
+     */
+    void ParallelFor(size_t count, size_t grain, const InplaceFunction<void(size_t, size_t)>& fn);
+
+    /// Run all tasks of @a graph, in dependency order, and wait for completion
+    void Run(TaskGraph& graph);
+
+private:
+    class Worker;
+
+    /*
+     * Completion count of a ParallelFor or TaskGraph run. Owned by the pool, since the
+     * job which completes the run still uses it after the waiter has been released.
+     */
+    struct Counter
+    {
+        std::atomic<uint32_t> pending {0};
+        binary_semaphore done {0};
+        // Released on completion: done, or the semaphore of a waiting worker
+        binary_semaphore* wakeup {nullptr};
+        // The waiter and the completing job. The last one to let go frees the counter
+        std::atomic<uint8_t> references {0};
+    };
+
+    struct Entry
+    {
+        Job job;
+        Counter* counter;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        etl::deque<Entry, kJobQueueSize> jobs;
+    };
+
+    // Return a counter for @a jobs, or nullptr if too many runs wait
+    Counter* AllocateCounter(uint32_t jobs);
+
+    void PutCounter(Counter& counter);
+
+    // A job of @a counter has run
+    void Complete(Counter& counter);
+
+    void Submit(Job job, Counter& counter);
+
+    // Run a job from the queue of @a index first, then from the others
+    bool RunOne(size_t index);
+
+    // Help with the jobs until @a counter completes, and free it
+    void Wait(Counter& counter);
+
+    // The worker of the calling thread, if it's one of ours
+    Worker* GetCurrentWorker() const;
+
+    void RunTask(TaskGraph& graph, TaskGraph::TaskId id, Counter& counter);
+
+    std::unique_ptr<Queue[]> m_queues;
+    size_t m_queue_count;
+    std::atomic<size_t> m_next_queue {0};
+
+    std::array<Counter, kMaxJobPoolWaits> m_counters;
+    std::atomic<uint32_t> m_free_counters {(1u << kMaxJobPoolWaits) - 1};
+    static_assert(kMaxJobPoolWaits < 32);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+};
+
+} // namespace os
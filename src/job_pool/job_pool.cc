@@ -0,0 +1,381 @@
+#include "job_pool.hh"
+
+#include "debug_assert.hh"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+
+using namespace os;
+
+class JobPool::Worker : public OsThread
+{
+public:
+    Worker(JobPool& parent, size_t index)
+        : m_parent(parent)
+        , m_index(index)
+    {
+    }
+
+    void Awake() final
+    {
+        m_semaphore.release();
+    }
+
+    const JobPool& GetParent() const
+    {
+        return m_parent;
+    }
+
+    size_t GetIndex() const
+    {
+        return m_index;
+    }
+
+    binary_semaphore& GetSemaphore()
+    {
+        return m_semaphore;
+    }
+
+    // The worker of the calling thread, if any
+    static inline thread_local Worker* s_current {nullptr};
+
+private:
+    void ThreadLoop() final
+    {
+        s_current = this;
+
+        while (IsRunning())
+        {
+            if (!m_parent.RunOne(m_index))
+            {
+                m_semaphore.acquire();
+            }
+        }
+    }
+
+    JobPool& m_parent;
+    const size_t m_index;
+    binary_semaphore m_semaphore {0};
+};
+
+
+TaskGraph::TaskId
+TaskGraph::Add(Job job)
+{
+    debug_assert(!m_tasks.full());
+
+    auto& task = m_tasks.emplace_back();
+    task.job = std::move(job);
+
+    return m_tasks.size() - 1;
+}
+
+void
+TaskGraph::Precede(TaskId before, TaskId after)
+{
+    debug_assert(before < m_tasks.size() && after < m_tasks.size());
+
+    m_tasks[before].successors.push_back(after);
+    m_tasks[after].predecessors++;
+}
+
+
+JobPool::JobPool(size_t workers, ThreadPriority priority, uint32_t stack_size)
+    : m_queues(std::make_unique<Queue[]>(std::max<size_t>(workers, 1)))
+    , m_queue_count(std::max<size_t>(workers, 1))
+{
+    auto cores = GetCoreCount();
+
+    // Started workers must not see the vector grow
+    m_workers.reserve(workers);
+    for (auto i = 0u; i < workers; i++)
+    {
+        auto& worker = m_workers.emplace_back(std::make_unique<Worker>(*this, i));
+
+        worker->Start("job_worker", static_cast<ThreadCore>(i % cores), priority, stack_size);
+    }
+}
+
+JobPool::~JobPool()
+{
+    for (auto& worker : m_workers)
+    {
+        worker->Stop();
+    }
+}
+
+void
+JobPool::ParallelFor(size_t count, size_t grain, const InplaceFunction<void(size_t, size_t)>& fn)
+{
+    grain = std::max<size_t>(grain, 1);
+
+    auto jobs = (count + grain - 1) / grain;
+    if (jobs == 0)
+    {
+        return;
+    }
+
+    auto counter = AllocateCounter(jobs);
+    if (!counter)
+    {
+        // Too many runs wait already: run it here
+        for (size_t begin = 0; begin < count; begin += grain)
+        {
+            fn(begin, std::min(begin + grain, count));
+        }
+        return;
+    }
+
+    for (size_t begin = 0; begin < count; begin += grain)
+    {
+        auto end = std::min(begin + grain, count);
+
+        Submit([&fn, begin, end]() { fn(begin, end); }, *counter);
+    }
+
+    Wait(*counter);
+}
+
+void
+JobPool::Run(TaskGraph& graph)
+{
+    if (graph.m_tasks.empty())
+    {
+        return;
+    }
+
+    for (auto& task : graph.m_tasks)
+    {
+        task.predecessors_left.store(task.predecessors, std::memory_order_relaxed);
+    }
+
+    auto counter = AllocateCounter(graph.m_tasks.size());
+    if (!counter)
+    {
+        // Too many runs wait already: run it here, in dependency order
+        etl::vector<TaskGraph::TaskId, kMaxTasks> ready;
+
+        for (auto i = 0u; i < graph.m_tasks.size(); i++)
+        {
+            if (graph.m_tasks[i].predecessors == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+        while (!ready.empty())
+        {
+            auto& task = graph.m_tasks[ready.back()];
+
+            ready.pop_back();
+            task.job();
+            for (auto successor : task.successors)
+            {
+                if (graph.m_tasks[successor].predecessors_left.fetch_sub(1) == 1)
+                {
+                    ready.push_back(successor);
+                }
+            }
+        }
+        return;
+    }
+
+    for (auto i = 0u; i < graph.m_tasks.size(); i++)
+    {
+        if (graph.m_tasks[i].predecessors == 0)
+        {
+            RunTask(graph, i, *counter);
+        }
+    }
+
+    Wait(*counter);
+}
+
+void
+JobPool::RunTask(TaskGraph& graph, TaskGraph::TaskId id, Counter& counter)
+{
+    Submit(
+        [this, &graph, &counter, id]() {
+            auto& task = graph.m_tasks[id];
+
+            task.job();
+
+            // Successors are submitted before this task completes, so the counter stays
+            // non-zero until the whole graph has run
+            for (auto successor : task.successors)
+            {
+                if (graph.m_tasks[successor].predecessors_left.fetch_sub(
+                        1, std::memory_order_acq_rel) == 1)
+                {
+                    RunTask(graph, successor, counter);
+                }
+            }
+        },
+        counter);
+}
+
+JobPool::Counter*
+JobPool::AllocateCounter(uint32_t jobs)
+{
+    auto free = m_free_counters.load(std::memory_order_relaxed);
+
+    do
+    {
+        if (free == 0)
+        {
+            return nullptr;
+        }
+    } while (!m_free_counters.compare_exchange_weak(
+        free, free & (free - 1), std::memory_order_acquire, std::memory_order_relaxed));
+
+    auto& counter = m_counters[std::countr_zero(free)];
+    auto worker = GetCurrentWorker();
+
+    counter.pending.store(jobs, std::memory_order_relaxed);
+    counter.references.store(2, std::memory_order_relaxed);
+    // A waiting worker also wakes up for new jobs in its own queue
+    counter.wakeup = worker ? &worker->GetSemaphore() : &counter.done;
+
+    return &counter;
+}
+
+void
+JobPool::PutCounter(Counter& counter)
+{
+    if (counter.references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        auto index = &counter - m_counters.data();
+
+        m_free_counters.fetch_or(1u << index, std::memory_order_release);
+    }
+}
+
+void
+JobPool::Complete(Counter& counter)
+{
+    if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // The waiter may return now, but the counter stays allocated until this lets go
+        counter.wakeup->release();
+        PutCounter(counter);
+    }
+}
+
+void
+JobPool::Submit(Job job, Counter& counter)
+{
+    auto worker = GetCurrentWorker();
+    // Work from a worker goes to its own queue, the rest is spread over the workers
+    auto index = worker ? worker->GetIndex()
+                        : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queue_count;
+    auto& queue = m_queues[index];
+    auto queued = false;
+
+    {
+        std::scoped_lock lock(queue.mutex);
+
+        if (!queue.jobs.full())
+        {
+            queue.jobs.push_back({std::move(job), &counter});
+            queued = true;
+        }
+    }
+
+    if (!queued)
+    {
+        // Queue full: run it here instead
+        job();
+        Complete(counter);
+        return;
+    }
+
+    if (worker && m_workers.size() > 1)
+    {
+        // Let another worker steal it
+        auto other = m_next_queue.fetch_add(1, std::memory_order_relaxed) % (m_workers.size() - 1);
+
+        m_workers[(index + 1 + other) % m_workers.size()]->Awake();
+    }
+    else if (!worker && index < m_workers.size())
+    {
+        m_workers[index]->Awake();
+    }
+}
+
+bool
+JobPool::RunOne(size_t index)
+{
+    std::optional<Entry> entry;
+
+    for (auto i = 0u; i < m_queue_count && !entry; i++)
+    {
+        auto& queue = m_queues[(index + i) % m_queue_count];
+        std::scoped_lock lock(queue.mutex);
+
+        if (queue.jobs.empty())
+        {
+            continue;
+        }
+
+        // Newest first from the own queue, oldest first when stealing
+        if (i == 0)
+        {
+            entry.emplace(std::move(queue.jobs.back()));
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            entry.emplace(std::move(queue.jobs.front()));
+            queue.jobs.pop_front();
+        }
+    }
+
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->job();
+    Complete(*entry->counter);
+
+    return true;
+}
+
+void
+JobPool::Wait(Counter& counter)
+{
+    auto worker = GetCurrentWorker();
+    auto index = worker ? worker->GetIndex()
+                        : m_next_queue.load(std::memory_order_relaxed) % m_queue_count;
+
+    // Help with the jobs, and block when there is nothing left to run
+    while (counter.pending.load(std::memory_order_acquire) != 0)
+    {
+        if (RunOne(index))
+        {
+            continue;
+        }
+        if (!worker)
+        {
+            break;
+        }
+
+        // Released on completion, or for new jobs in the own queue
+        worker->GetSemaphore().acquire();
+    }
+
+    if (!worker)
+    {
+        // Always released once, also if the last job ran here
+        counter.done.acquire();
+    }
+    PutCounter(counter);
+}
+
+JobPool::Worker*
+JobPool::GetCurrentWorker() const
+{
+    auto worker = Worker::s_current;
+
+    return worker && &worker->GetParent() == this ? worker : nullptr;
+}
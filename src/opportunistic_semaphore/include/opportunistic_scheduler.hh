@@ -3,21 +3,45 @@
 #include "opportunistic_semaphore.hh"
 #include "os/thread.hh"
 #include "debug_assert.hh"
+#include "hal/i_pm.hh"
+#include "timer_heap.hh"
+#include "wakeup_profile.hh"
 
-// TODO: Replace with safe
 #include <algorithm>
+#include <array>
 #include <atomic>
-#include <deque>
+#include <etl/bitset.h>
+#include <etl/vector.h>
+#include <memory>
 #include <mutex>
-#include <unordered_set>
-#include <vector>
+#include <optional>
 
 class SchedulerFixture;
 
 namespace os
 {
 
-constexpr auto kMaxSemaphores = 32;
+/// The number of semaphores per scheduler
+constexpr auto kMaxSemaphores = 128;
+/// The number of threads which can wait in the scheduler at the same time
+constexpr auto kMaxSchedulerWaiters = 32;
+
+struct SchedulerPowerConfiguration
+{
+    /// Wakeups are moved to a multiple of this within their interval, so they share windows
+    milliseconds wakeup_alignment {10ms};
+    /// The longest a batch keeps the CPU at full power, for threads which don't wait again
+    milliseconds max_batch_time {20ms};
+};
+
+struct SchedulerPowerStatistics
+{
+    /// The (estimated) time the batches have held the CPU at full power
+    milliseconds full_power_time {0ms};
+    uint32_t batches {0};
+    /// Threads woken in the batches
+    uint32_t wakeups {0};
+};
 
 class OpportunisticScheduler
 {
@@ -28,24 +52,39 @@ public:
     explicit OpportunisticScheduler(os::binary_semaphore& semaphore);
     ~OpportunisticScheduler();
 
-    uint8_t AddSemaphore(OpportunisticBinarySemaphore* sem)
+    /**
+     * @brief Batch the wakeups to save power.
+     *
+     * The scheduler holds a full-power lock from @a pm while a batch of woken threads
+     * runs, i.e., until all of them wait in the scheduler again (or max_batch_time has
+     * passed). Upcoming wakeups are aligned to shared windows, so the CPU can lower the
+     * frequency or light-sleep between the batches.
+     */
+    void EnablePowerManagement(hal::IPm& pm, const SchedulerPowerConfiguration& configuration = {});
+
+    SchedulerPowerStatistics GetPowerStatistics();
+
+    /// Return the index of @a sem, or std::nullopt if all kMaxSemaphores are used
+    std::optional<uint8_t> AddSemaphore(OpportunisticBinarySemaphore* sem)
     {
-        for (size_t i = 0; i < m_semaphores.size(); ++i)
+        std::scoped_lock lock(m_mutex);
+        auto it = std::find(m_semaphores.begin(), m_semaphores.end(), nullptr);
+
+        if (it == m_semaphores.end())
         {
-            if (m_semaphores[i] == nullptr)
-            {
-                m_semaphores[i] = sem;
-                return static_cast<uint8_t>(i);
-            }
+            return std::nullopt;
         }
+        *it = sem;
 
-        debug_assert(m_semaphores.size() < kMaxSemaphores);
-        m_semaphores.push_back(sem);
-        return static_cast<uint8_t>(m_semaphores.size() - 1);
+        auto index = static_cast<uint8_t>(it - m_semaphores.begin());
+        m_wakeup_profile.Reset(index);
+
+        return index;
     }
 
     void RemoveSemaphore(OpportunisticBinarySemaphore* sem)
     {
+        std::scoped_lock lock(m_mutex);
         auto it = std::find(m_semaphores.begin(), m_semaphores.end(), sem);
         if (it != m_semaphores.end())
         {
@@ -53,38 +92,104 @@ public:
         }
     }
 
-    void AddPendingEntry(ThreadHandle thread, uint8_t sem_index, const WakeupConfiguration& config);
+    /// Add a waiter to wake in its interval. False if all waiter slots are used, and the
+    /// caller has to wait without the scheduler
+    bool AddPendingEntry(ThreadHandle thread, uint8_t sem_index, const WakeupConfiguration& config);
 
-    void AddEarlyEntry(ThreadHandle thread, uint8_t sem_index, const WakeupConfiguration& config);
+    /// Like AddPendingEntry(), but not woken before no_earlier_than
+    bool AddEarlyEntry(ThreadHandle thread, uint8_t sem_index, const WakeupConfiguration& config);
 
 
+    /// Wake the waiters of @a sem_index on the next Schedule(). Lock-free
     void RequestScheduleForSemaphore(uint8_t sem_index);
+
+    /// Same as RequestScheduleForSemaphore(), from an ISR. Return true if a higher prio task
+    /// was awoken
+    bool RequestScheduleForSemaphoreFromIsr(uint8_t sem_index);
+
     void RequestSchedule();
 
     // Return the next wakeup time
     std::optional<milliseconds> Schedule();
 
+    /**
+     * @brief The wakeup histograms of the waits on @a sem_index, see WakeupReason.
+     *
+     * Empty unless MAELIR_PROFILING is defined.
+     */
+    WakeupStatistics GetWakeupStatistics(uint8_t sem_index);
+
+    /// Print the histograms of the semaphores which have had wakeups
+    void DumpWakeupStatistics();
+
 private:
-    os::binary_semaphore& m_semaphore;
-    std::vector<OpportunisticBinarySemaphore*> m_semaphores;
+    using Waiters = etl::bitset<kMaxSchedulerWaiters, uint32_t>;
+    using WaiterHeap = TimerHeap<kMaxSchedulerWaiters>;
 
-    std::unordered_set<uint8_t> m_released_semaphores;
+    /// Return the slot of a new waiter, or std::nullopt if full
+    std::optional<uint8_t> AddWaiter(ThreadHandle thread,
+                                     uint8_t sem_index,
+                                     const WakeupConfiguration& config);
 
-    // Threads where the low interval has not yet been reached
-    std::deque<OpportunisticBinarySemaphore::WaitEntry> m_pending;
-    // Threads which have not yet reached the allowed earliest time
-    std::deque<OpportunisticBinarySemaphore::WaitEntry> m_too_early;
+    // Wake the pending waiters of a released semaphore, and make the too-early ones pending
+    void ReleaseWaiters(unsigned sem_index, milliseconds now);
 
+    void WakeWaiter(uint8_t slot, milliseconds now, WakeupReason reason);
 
-    std::array<std::deque<OpportunisticBinarySemaphore::WaitEntry>, kMaxSemaphores>
-        m_too_early_per_semaphore;
+    // A thread of the running batch waits again
+    void OnWaitAgain(ThreadHandle thread);
 
+    void EndBatch(milliseconds now);
+
+    // The time to wake for @a config, aligned if possible
+    milliseconds AlignedWakeup(const WakeupConfiguration& config) const;
+
+    os::binary_semaphore& m_semaphore;
+    std::array<OpportunisticBinarySemaphore*, kMaxSemaphores> m_semaphores {};
+
+    // One bit per semaphore, set by threads and ISRs and taken by Schedule()
+    std::array<std::atomic<uint32_t>, kMaxSemaphores / 32> m_released_semaphores {};
+    static_assert(kMaxSemaphores % 32 == 0 && kMaxSemaphores <= 256);
+
+    /*
+     * The waiters live in fixed slots, which the heaps below index. A waiter is either
+     * pending or too early, never both.
+     */
+    std::array<OpportunisticBinarySemaphore::WaitEntry, kMaxSchedulerWaiters> m_waiters;
+    Waiters m_used_waiters;
+    // The waiters (pending or too early) of each semaphore
+    std::array<Waiters, kMaxSemaphores> m_waiters_per_semaphore;
+
+    // Threads where the low interval has not yet been reached, keyed on the latest time
+    WaiterHeap m_pending;
+    // Threads which have not yet reached the allowed earliest time, keyed on that time
+    WaiterHeap m_too_early;
+    // The same threads, keyed on the latest time
+    WaiterHeap m_too_early_latest;
+
+    // Power management, see EnablePowerManagement()
+    std::unique_ptr<hal::IPm::ILock> m_full_power_lock;
+    SchedulerPowerConfiguration m_power_configuration {0ms, 0ms};
+    SchedulerPowerStatistics m_power_statistics;
+    // The start of the running batch, if any
+    std::optional<milliseconds> m_batch_start;
+    // The woken threads which have not yet waited again
+    etl::vector<ThreadHandle, kMaxSchedulerWaiters> m_batch;
+
+    WakeupProfile<kMaxSemaphores, kMaxSchedulerWaiters> m_wakeup_profile;
 
     std::mutex m_mutex;
 };
 
 class OpportunisticSchedulerThread : public os::OsThread
 {
+public:
+    OpportunisticScheduler& GetScheduler()
+    {
+        return m_scheduler;
+    }
+
+private:
     void Awake() final
     {
         m_semaphore.release();
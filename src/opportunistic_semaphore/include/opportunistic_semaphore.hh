@@ -1,15 +1,14 @@
 #pragma once
 
 #include "event_notifier.hh"
+#include "isr_attr.hh"
 #include "os/thread.hh"
 #include "semaphore.hh"
+#include "wakeup_profile.hh"
 
-// TODO: Replace with safe
 #include <atomic>
-#include <deque>
 #include <mutex>
-#include <unordered_set>
-#include <vector>
+#include <optional>
 
 class SchedulerFixture;
 
@@ -73,6 +72,7 @@ LatestAfter(milliseconds time)
 
 class OpportunisticScheduler;
 
+/// The default scheduler, the first one which is created
 extern OpportunisticScheduler* g_scheduler;
 
 class OpportunisticBinarySemaphore : public IEventNotifier
@@ -81,7 +81,16 @@ public:
     friend class ::SchedulerFixture;
     friend class OpportunisticScheduler;
 
+    /// Bound to g_scheduler
     explicit OpportunisticBinarySemaphore(uint8_t initial_value);
+
+    /**
+     * @brief Bound to @a scheduler, e.g., the one of the core of the waiting threads.
+     *
+     * With one scheduler per core, the opportunistic waits on one core don't contend with
+     * the other core.
+     */
+    OpportunisticBinarySemaphore(OpportunisticScheduler& scheduler, uint8_t initial_value);
     ~OpportunisticBinarySemaphore();
 
     void release();
@@ -110,23 +119,19 @@ public:
 
     bool try_acquire_for(const WakeupConfiguration& config);
 
+    /// The wakeup histograms of the opportunistic waits, see OpportunisticScheduler
+    WakeupStatistics GetWakeupStatistics() const;
+
     void Notify() final
     {
         release();
     }
 
-    void NotifyFromIsr() final
+    MAELIR_ISR_ATTR void NotifyFromIsr() final
     {
         release_from_isr();
     }
 
-    // TODO: Privatize, but maybe available for unit tests
-    struct Entry
-    {
-        os::ThreadHandle thread;
-        WakeupConfiguration config;
-    };
-
     struct WaitEntry
     {
         os::ThreadHandle thread;
@@ -135,9 +140,10 @@ public:
     };
 
 private:
-    const uint8_t m_semaphore_index;
+    OpportunisticScheduler& m_scheduler;
+    // Without a slot in the scheduler, this is a plain binary semaphore
+    const std::optional<uint8_t> m_semaphore_index;
     os::binary_semaphore m_semaphore;
-    std::deque<Entry> m_waiting_threads;
 };
 
 } // namespace os
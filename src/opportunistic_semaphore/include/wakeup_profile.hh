@@ -0,0 +1,153 @@
+#pragma once
+
+#include "time.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <etl/vector.h>
+#include <numeric>
+#include <utility>
+
+/*
+ * Wakeup quality of the opportunistic scheduler, enabled with -DMAELIR_PROFILING=ON
+ * like thread_profile.hh. When disabled, WakeupProfile is empty and every call compiles
+ * to nothing.
+ */
+
+namespace os
+{
+
+/// Why the scheduler woke a waiter
+enum class WakeupReason : uint8_t
+{
+    // The semaphore of the waiter was released
+    kReleased,
+    // Woken in its interval, before its own (aligned) deadline, since the scheduler ran anyway
+    kPiggybacked,
+    // The (aligned) latest time of the waiter was reached
+    kForced,
+
+    kValueCount,
+};
+
+/// Histograms of the wakeups of one semaphore, see OpportunisticScheduler::GetWakeupStatistics()
+struct WakeupStatistics
+{
+    static constexpr auto kLatenessBuckets = 8;
+    static constexpr auto kMergedBuckets = 6;
+
+    /// Wakeups per WakeupReason
+    std::array<uint32_t, std::to_underlying(WakeupReason::kValueCount)> reasons {};
+    /// Time after latest, in buckets of 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63 and 64+ ms
+    std::array<uint32_t, kLatenessBuckets> lateness {};
+    /// Threads woken in the same Schedule(), in buckets of 1, 2, 3-4, 5-8, 9-16 and 17+
+    std::array<uint32_t, kMergedBuckets> merged {};
+
+    uint32_t Wakeups() const
+    {
+        return std::accumulate(reasons.begin(), reasons.end(), uint32_t {0});
+    }
+
+    uint32_t Count(WakeupReason reason) const
+    {
+        return reasons[std::to_underlying(reason)];
+    }
+
+    static constexpr size_t LatenessBucket(milliseconds lateness)
+    {
+        return std::min<size_t>(std::bit_width(lateness.count()), kLatenessBuckets - 1);
+    }
+
+    static constexpr size_t MergedBucket(size_t wakeups)
+    {
+        return std::min<size_t>(std::bit_width(wakeups - 1), kMergedBuckets - 1);
+    }
+};
+
+#if defined(MAELIR_PROFILING)
+
+/**
+ * @brief The wakeup histograms of all semaphores of a scheduler.
+ *
+ * Updated under the scheduler mutex. The woken semaphores of a Schedule() round are
+ * kept until EndSchedule(), when the number of merged wakeups is known.
+ */
+template <size_t Semaphores, size_t Waiters>
+class WakeupProfile
+{
+public:
+    /// A new semaphore takes @a sem_index
+    void Reset(uint8_t sem_index)
+    {
+        m_statistics[sem_index] = {};
+    }
+
+    void OnWakeup(uint8_t sem_index, WakeupReason reason, milliseconds lateness)
+    {
+        auto& statistics = m_statistics[sem_index];
+
+        statistics.reasons[std::to_underlying(reason)]++;
+        statistics.lateness[WakeupStatistics::LatenessBucket(lateness)]++;
+        if (!m_round.full())
+        {
+            m_round.push_back(sem_index);
+        }
+    }
+
+    /// The Schedule() round is over
+    void EndSchedule()
+    {
+        if (m_round.empty())
+        {
+            return;
+        }
+
+        auto bucket = WakeupStatistics::MergedBucket(m_round.size());
+
+        for (auto sem_index : m_round)
+        {
+            m_statistics[sem_index].merged[bucket]++;
+        }
+        m_round.clear();
+    }
+
+    WakeupStatistics GetStatistics(uint8_t sem_index) const
+    {
+        return m_statistics[sem_index];
+    }
+
+private:
+    std::array<WakeupStatistics, Semaphores> m_statistics;
+    etl::vector<uint8_t, Waiters> m_round;
+};
+
+#else
+
+template <size_t Semaphores, size_t Waiters>
+class WakeupProfile
+{
+public:
+    void Reset(uint8_t)
+    {
+    }
+
+    void OnWakeup(uint8_t, WakeupReason, milliseconds)
+    {
+    }
+
+    void EndSchedule()
+    {
+    }
+
+    WakeupStatistics GetStatistics(uint8_t) const
+    {
+        return {};
+    }
+};
+
+#endif
+
+} // namespace os
@@ -1,9 +1,12 @@
 #include "opportunistic_scheduler.hh"
 
 #include "debug_assert.hh"
+#include "isr_attr.hh"
+#include "trace.hh"
 
 #include <algorithm>
-#include <ranges>
+#include <bit>
+#include <cstdio>
 
 using namespace os;
 
@@ -16,15 +19,52 @@ OpportunisticScheduler* g_scheduler;
 OpportunisticScheduler::OpportunisticScheduler(os::binary_semaphore& semaphore)
     : m_semaphore(semaphore)
 {
-    g_scheduler = this;
+    // The first one is the default for semaphores
+    if (!g_scheduler)
+    {
+        g_scheduler = this;
+    }
 }
 
 OpportunisticScheduler::~OpportunisticScheduler()
 {
-    g_scheduler = nullptr;
+    if (m_batch_start)
+    {
+        EndBatch(os::GetTimeStamp());
+    }
+    if (g_scheduler == this)
+    {
+        g_scheduler = nullptr;
+    }
 }
 
 void
+OpportunisticScheduler::EnablePowerManagement(hal::IPm& pm,
+                                              const SchedulerPowerConfiguration& configuration)
+{
+    std::scoped_lock lock(m_mutex);
+
+    debug_assert(!m_full_power_lock);
+    m_full_power_lock = pm.CreateFullPowerLock();
+    m_power_configuration = configuration;
+}
+
+SchedulerPowerStatistics
+OpportunisticScheduler::GetPowerStatistics()
+{
+    std::scoped_lock lock(m_mutex);
+    auto out = m_power_statistics;
+
+    // Include the running batch
+    if (m_batch_start)
+    {
+        out.full_power_time += os::GetTimeStamp() - *m_batch_start;
+    }
+
+    return out;
+}
+
+bool
 OpportunisticScheduler::AddPendingEntry(ThreadHandle thread,
                                         uint8_t sem_index,
                                         const WakeupConfiguration& config)
@@ -35,19 +75,21 @@ OpportunisticScheduler::AddPendingEntry(ThreadHandle thread,
     debug_assert(sem_index < kMaxSemaphores);
 
     std::scoped_lock lock(m_mutex);
-    auto now = os::GetTimeStamp();
-    WakeupConfiguration adjusted_config = config + now;
-
-    m_pending.push_back({thread, adjusted_config, sem_index});
 
-    std::ranges::sort(
-        m_pending, {}, [](const auto& entry) { return entry.config.wakeup_interval.latest; });
+    auto slot = AddWaiter(thread, sem_index, config);
+    if (!slot)
+    {
+        return false;
+    }
 
+    m_pending.Insert(*slot, m_waiters[*slot].config.wakeup_interval.latest);
     m_semaphore.release();
+
+    return true;
 }
 
 
-void
+bool
 OpportunisticScheduler::AddEarlyEntry(ThreadHandle thread,
                                       uint8_t sem_index,
                                       const WakeupConfiguration& config)
@@ -56,17 +98,20 @@ OpportunisticScheduler::AddEarlyEntry(ThreadHandle thread,
     debug_assert(sem_index < kMaxSemaphores);
 
     std::scoped_lock lock(m_mutex);
-    auto now = os::GetTimeStamp();
-    WakeupConfiguration adjusted_config = config + now;
 
-    m_too_early.push_back({thread, adjusted_config, sem_index});
-    m_too_early_per_semaphore[sem_index].push_back({thread, adjusted_config, sem_index});
+    auto slot = AddWaiter(thread, sem_index, config);
+    if (!slot)
+    {
+        return false;
+    }
 
-    std::ranges::sort(m_too_early, {}, [](const auto& entry) {
-        return entry.config.no_earlier_than;
-    });
+    const auto& adjusted_config = m_waiters[*slot].config;
 
+    m_too_early.Insert(*slot, adjusted_config.no_earlier_than);
+    m_too_early_latest.Insert(*slot, adjusted_config.wakeup_interval.latest);
     m_semaphore.release();
+
+    return true;
 }
 
 void
@@ -78,115 +123,264 @@ OpportunisticScheduler::RequestSchedule()
 void
 OpportunisticScheduler::RequestScheduleForSemaphore(uint8_t sem_index)
 {
-    std::scoped_lock lock(m_mutex);
-    m_released_semaphores.insert(sem_index);
+    m_released_semaphores[sem_index / 32].fetch_or(1u << (sem_index % 32),
+                                                   std::memory_order_release);
     RequestSchedule();
 }
 
+bool MAELIR_ISR_ATTR
+OpportunisticScheduler::RequestScheduleForSemaphoreFromIsr(uint8_t sem_index)
+{
+    m_released_semaphores[sem_index / 32].fetch_or(1u << (sem_index % 32),
+                                                   std::memory_order_release);
+
+    return m_semaphore.release_from_isr();
+}
+
 std::optional<milliseconds>
 OpportunisticScheduler::Schedule()
 {
+    trace::Scope trace_scope(trace::Event::kSchedule);
     std::scoped_lock lock(m_mutex);
 
-
-    milliseconds out = 0xffffffffms;
     auto now = os::GetTimeStamp();
 
-    std::vector<ThreadHandle> ready_for_wakeup;
+    if (m_batch_start && now - *m_batch_start >= m_power_configuration.max_batch_time)
+    {
+        // Some threads didn't come back, but the batch is over anyway
+        EndBatch(now);
+    }
 
-    for (auto released : m_released_semaphores)
+    for (auto word = 0u; word < m_released_semaphores.size(); word++)
     {
-        /*
-         * Move all pending for this thread to ready-for-wakeup (before too-early has been evaluated).
-         *
-         * This might have to be reconsidered, if the semaphore is released multiple times before the
-         * too-early time has passed.
-         */
-        auto pending = std::ranges::remove_if(
-            m_pending, [&](const auto& e) { return e.sem_index == released; });
-        for (auto& entry : pending)
-        {
-            ready_for_wakeup.push_back(entry.thread);
-        }
-        m_pending.erase(pending.begin(), pending.end());
+        auto released_mask = m_released_semaphores[word].exchange(0, std::memory_order_acquire);
 
-        for (auto& entry : m_too_early_per_semaphore[released])
+        while (released_mask)
         {
-            out = entry.config.no_earlier_than;
-            entry.config.wakeup_interval.earliest = entry.config.no_earlier_than;
-            entry.config.wakeup_interval.latest = entry.config.no_earlier_than;
+            auto released = word * 32 + std::countr_zero(released_mask);
 
-            m_pending.push_back(entry);
+            released_mask &= released_mask - 1;
+            ReleaseWaiters(released, now);
         }
-        auto it = std::ranges::remove_if(m_too_early,
-                                         [&](const auto& e) { return e.sem_index == released; });
-        m_too_early.erase(it.begin(), it.end());
-        m_too_early_per_semaphore[released].clear();
     }
-    m_released_semaphores.clear();
 
-    while (!m_too_early.empty())
+    while (auto slot = m_too_early.PopExpired(now))
     {
-        auto& entry = m_too_early.front();
+        const auto& config = m_waiters[*slot].config;
 
-        if (entry.config.no_earlier_than <= now)
+        m_too_early_latest.Remove(*slot);
+        if (now > config.wakeup_interval.latest)
         {
-            if (now > entry.config.wakeup_interval.latest)
-            {
-                os::AwakeThread(entry.thread);
-            }
-            else
-            {
-                m_pending.push_back(entry);
-            }
-
-            m_too_early.pop_front();
+            WakeWaiter(*slot, now, WakeupReason::kForced);
         }
         else
+        {
+            m_pending.Insert(*slot, config.wakeup_interval.latest);
+        }
+    }
+
+    // In the order of the latest time, until the first which is not yet in its interval
+    while (auto slot = m_pending.Front())
+    {
+        const auto& config = m_waiters[*slot].config;
+
+        if (now < config.wakeup_interval.earliest)
         {
             break;
         }
+
+        auto reason = detail::IsBefore(now, AlignedWakeup(config)) ? WakeupReason::kPiggybacked
+                                                                   : WakeupReason::kForced;
+
+        m_pending.Remove(*slot);
+        WakeWaiter(*slot, now, reason);
     }
+    m_wakeup_profile.EndSchedule();
 
-    for (const auto& entry : m_too_early)
+    std::optional<milliseconds> out;
+    auto update = [&out](milliseconds time) {
+        if (!out || detail::IsBefore(time, *out))
+        {
+            out = time;
+        }
+    };
+
+    if (auto slot = m_pending.Front())
+    {
+        update(AlignedWakeup(m_waiters[*slot].config));
+    }
+    if (auto slot = m_too_early_latest.Front())
     {
-        out = std::min(out, entry.config.wakeup_interval.latest);
+        update(AlignedWakeup(m_waiters[*slot].config));
+    }
+    if (m_batch_start)
+    {
+        update(*m_batch_start + m_power_configuration.max_batch_time);
     }
 
-    m_released_semaphores.clear();
-    std::ranges::sort(
-        m_pending, {}, [](const auto& entry) { return entry.config.wakeup_interval.latest; });
+    return out;
+}
 
-    while (!m_pending.empty())
+WakeupStatistics
+OpportunisticScheduler::GetWakeupStatistics(uint8_t sem_index)
+{
+    debug_assert(sem_index < kMaxSemaphores);
+    std::scoped_lock lock(m_mutex);
+
+    return m_wakeup_profile.GetStatistics(sem_index);
+}
+
+void
+OpportunisticScheduler::DumpWakeupStatistics()
+{
+    for (auto sem_index = 0u; sem_index < kMaxSemaphores; sem_index++)
     {
-        out = m_pending.front().config.wakeup_interval.latest;
+        auto s = GetWakeupStatistics(sem_index);
 
-        if (now < m_pending.front().config.wakeup_interval.earliest)
+        if (s.Wakeups() == 0)
         {
-            break;
+            continue;
+        }
+
+        printf("sem %3u released %6lu piggybacked %6lu forced %6lu late",
+               sem_index,
+               static_cast<unsigned long>(s.Count(WakeupReason::kReleased)),
+               static_cast<unsigned long>(s.Count(WakeupReason::kPiggybacked)),
+               static_cast<unsigned long>(s.Count(WakeupReason::kForced)));
+        for (auto count : s.lateness)
+        {
+            printf(" %5lu", static_cast<unsigned long>(count));
         }
-        const auto& entry = m_pending.front();
-        ready_for_wakeup.push_back(entry.thread);
-        m_pending.pop_front();
+        printf(" merged");
+        for (auto count : s.merged)
+        {
+            printf(" %5lu", static_cast<unsigned long>(count));
+        }
+        printf("\n");
     }
+}
 
-    for (auto& entry : ready_for_wakeup)
+void
+OpportunisticScheduler::ReleaseWaiters(unsigned sem_index, milliseconds now)
+{
+    const auto waiters = m_waiters_per_semaphore[sem_index];
+
+    /*
+     * This might have to be reconsidered, if the semaphore is released multiple times before the
+     * too-early time has passed.
+     */
+    for (auto slot = waiters.find_first(true); slot != waiters.npos;
+         slot = waiters.find_next(true, slot + 1))
     {
-        os::AwakeThread(entry);
+        if (m_pending.Contains(slot))
+        {
+            m_pending.Remove(slot);
+            WakeWaiter(slot, now, WakeupReason::kReleased);
+            continue;
+        }
+
+        auto& config = m_waiters[slot].config;
+
+        config.wakeup_interval.earliest = config.no_earlier_than;
+        config.wakeup_interval.latest = config.no_earlier_than;
+        m_too_early.Remove(slot);
+        m_too_early_latest.Remove(slot);
+        m_pending.Insert(slot, config.wakeup_interval.latest);
     }
-    ready_for_wakeup.clear();
+}
+
+std::optional<uint8_t>
+OpportunisticScheduler::AddWaiter(ThreadHandle thread,
+                                  uint8_t sem_index,
+                                  const WakeupConfiguration& config)
+{
+    auto slot = m_used_waiters.find_first(false);
 
-    if (m_pending.empty() && m_too_early.empty())
+    OnWaitAgain(thread);
+
+    if (slot == m_used_waiters.npos)
     {
         return std::nullopt;
     }
 
-    if (out == 0xffffffffms)
+    m_waiters[slot] = {thread, config + os::GetTimeStamp(), sem_index};
+    m_used_waiters.set(slot);
+    m_waiters_per_semaphore[sem_index].set(slot);
+
+    return static_cast<uint8_t>(slot);
+}
+
+void
+OpportunisticScheduler::WakeWaiter(uint8_t slot, milliseconds now, WakeupReason reason)
+{
+    const auto& waiter = m_waiters[slot];
+
+    m_used_waiters.reset(slot);
+    m_waiters_per_semaphore[waiter.sem_index].reset(slot);
+    m_wakeup_profile.OnWakeup(
+        waiter.sem_index, reason, detail::TimeUntil(now, waiter.config.wakeup_interval.latest));
+
+    if (m_full_power_lock)
     {
-        return std::nullopt;
+        // Before the thread runs
+        if (!m_batch_start)
+        {
+            m_full_power_lock->Lock();
+            m_batch_start = now;
+            m_power_statistics.batches++;
+        }
+        if (!m_batch.full() && std::ranges::find(m_batch, waiter.thread) == m_batch.end())
+        {
+            m_batch.push_back(waiter.thread);
+        }
+        m_power_statistics.wakeups++;
     }
 
-    return out;
+    os::AwakeThread(waiter.thread);
+}
+
+void
+OpportunisticScheduler::OnWaitAgain(ThreadHandle thread)
+{
+    if (!m_batch_start)
+    {
+        return;
+    }
+
+    if (auto it = std::ranges::find(m_batch, thread); it != m_batch.end())
+    {
+        m_batch.erase(it);
+    }
+    if (m_batch.empty())
+    {
+        EndBatch(os::GetTimeStamp());
+    }
+}
+
+void
+OpportunisticScheduler::EndBatch(milliseconds now)
+{
+    m_full_power_lock->Unlock();
+    m_power_statistics.full_power_time += now - *m_batch_start;
+    m_batch_start = std::nullopt;
+    m_batch.clear();
+}
+
+milliseconds
+OpportunisticScheduler::AlignedWakeup(const WakeupConfiguration& config) const
+{
+    const auto& [earliest, latest] = config.wakeup_interval;
+    auto alignment = m_power_configuration.wakeup_alignment;
+
+    if (alignment == 0ms)
+    {
+        return latest;
+    }
+
+    // The last window in the interval, if there is one
+    auto aligned = latest - latest % alignment;
+
+    return detail::IsBefore(aligned, earliest) ? latest : aligned;
 }
 
 
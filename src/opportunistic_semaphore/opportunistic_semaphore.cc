@@ -2,37 +2,63 @@
 #include "opportunistic_scheduler.hh"
 
 #include "debug_assert.hh"
+#include "isr_attr.hh"
 #include "os/thread.hh"
 
 using namespace os;
 
 OpportunisticBinarySemaphore::OpportunisticBinarySemaphore(uint8_t initial_value)
-    : m_semaphore_index(g_scheduler->AddSemaphore(this))
+    : OpportunisticBinarySemaphore(*g_scheduler, initial_value)
+{
+}
+
+OpportunisticBinarySemaphore::OpportunisticBinarySemaphore(OpportunisticScheduler& scheduler,
+                                                           uint8_t initial_value)
+    : m_scheduler(scheduler)
+    , m_semaphore_index(m_scheduler.AddSemaphore(this))
     , m_semaphore(initial_value)
 {
 }
 
 OpportunisticBinarySemaphore::~OpportunisticBinarySemaphore()
 {
-    g_scheduler->RemoveSemaphore(this);
+    m_scheduler.RemoveSemaphore(this);
 }
 
 void
 OpportunisticBinarySemaphore::release()
 {
     m_semaphore.release();
-    g_scheduler->RequestScheduleForSemaphore(m_semaphore_index);
+    if (m_semaphore_index)
+    {
+        m_scheduler.RequestScheduleForSemaphore(*m_semaphore_index);
+    }
 }
 
 // Return true if a higher prio task was awoken
-bool
+bool MAELIR_ISR_ATTR
 OpportunisticBinarySemaphore::release_from_isr()
 {
-    //    m_value.store(1, std::memory_order_release);
+    auto woken = m_semaphore.release_from_isr();
+
+    if (!m_semaphore_index)
+    {
+        return woken;
+    }
+
+    // Don't short-circuit, the scheduler has to be requested either way
+    return m_scheduler.RequestScheduleForSemaphoreFromIsr(*m_semaphore_index) | woken;
+}
+
+WakeupStatistics
+OpportunisticBinarySemaphore::GetWakeupStatistics() const
+{
+    if (!m_semaphore_index)
+    {
+        return {};
+    }
 
-    // TODO:
-    release();
-    return false;
+    return m_scheduler.GetWakeupStatistics(*m_semaphore_index);
 }
 
 bool
@@ -80,13 +106,18 @@ OpportunisticBinarySemaphore::try_acquire_for(const WakeupConfiguration& config)
             // Wait for a precise time - regular semaphore behavior
             auto out = m_semaphore.try_acquire_for_ms(config.wakeup_interval.latest);
             // Opportunistically wakeup
-            g_scheduler->RequestSchedule();
+            m_scheduler.RequestSchedule();
             return out;
         }
         else
         {
             // Pending opportunistic wakeup
-            g_scheduler->AddPendingEntry(self, m_semaphore_index, config);
+            if (!m_semaphore_index ||
+                !m_scheduler.AddPendingEntry(self, *m_semaphore_index, config))
+            {
+                // No semaphore or waiter slot left: Wait like a regular semaphore, until the latest time
+                return m_semaphore.try_acquire_for_ms(config.wakeup_interval.latest);
+            }
             os::SuspendThread(self);
             return m_semaphore.try_acquire();
         }
@@ -103,7 +134,15 @@ OpportunisticBinarySemaphore::try_acquire_for(const WakeupConfiguration& config)
         }
         else
         {
-            g_scheduler->AddEarlyEntry(self, m_semaphore_index, config);
+            if (!m_semaphore_index ||
+                !m_scheduler.AddEarlyEntry(self, *m_semaphore_index, config))
+            {
+                // No semaphore or waiter slot left: Wait like a regular semaphore, from the earliest time
+                // (the interval is from now) until the latest
+                os::Sleep(config.no_earlier_than);
+                return m_semaphore.try_acquire_for_ms(config.wakeup_interval.latest -
+                                                      config.no_earlier_than);
+            }
             os::SuspendThread(self);
             return m_semaphore.try_acquire();
         }
@@ -1,23 +1,222 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <new>
+#include <utility>
 
 #include "os_implementation.hh"
 
 namespace os
 {
 
-template <typename T>
-auto AllocFastMem(unsigned alignment = 4)
+enum class MemoryType : uint8_t
 {
-    return detail::AllocFastMem<T>(alignment);
+    kFast, // Internal RAM
+    kSlow, // PSRAM
+
+    kValueCount,
+};
+
+/**
+ * @brief The tag of allocations which are not attributed to a subsystem.
+ *
+ * A subsystem tags its allocations with its own type, which names it:
+ *
+ * @code
+ * struct DisplayMemory
+ * {
+ *     static constexpr const char* kName = "display";
+ * };
+ *
+ * auto frame_buffer = os::AllocSlowMem<FrameBuffer, DisplayMemory>();
+ * @endcode
+ */
+struct UntaggedMemory
+{
+    static constexpr const char* kName = "untagged";
+};
+
+struct MemoryUsage
+{
+    const char* name;
+    /// Bytes currently allocated, per MemoryType
+    size_t bytes[std::to_underlying(MemoryType::kValueCount)];
+    size_t peak_bytes[std::to_underlying(MemoryType::kValueCount)];
+    /// Live allocations
+    uint32_t allocations;
+};
+
+namespace detail
+{
+
+/// The allocations of one tag, in a static list of all tags
+class MemoryAccount
+{
+public:
+    explicit MemoryAccount(const char* name)
+        : m_name(name)
+        , m_next(s_first.load(std::memory_order_relaxed))
+    {
+        while (!s_first.compare_exchange_weak(
+            m_next, this, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    MemoryAccount(const MemoryAccount&) = delete;
+    MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+    void Add(MemoryType type, size_t size)
+    {
+        auto index = std::to_underlying(type);
+        auto bytes = m_bytes[index].fetch_add(size, std::memory_order_relaxed) + size;
+        auto peak = m_peak_bytes[index].load(std::memory_order_relaxed);
+
+        while (bytes > peak && !m_peak_bytes[index].compare_exchange_weak(
+                                   peak, bytes, std::memory_order_relaxed))
+        {
+        }
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Remove(MemoryType type, size_t size)
+    {
+        m_bytes[std::to_underlying(type)].fetch_sub(size, std::memory_order_relaxed);
+        m_allocations.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    MemoryUsage GetUsage() const
+    {
+        MemoryUsage out {m_name, {}, {}, m_allocations.load(std::memory_order_relaxed)};
+
+        for (auto i = 0u; i < std::size(m_bytes); i++)
+        {
+            out.bytes[i] = m_bytes[i].load(std::memory_order_relaxed);
+            out.peak_bytes[i] = m_peak_bytes[i].load(std::memory_order_relaxed);
+        }
+
+        return out;
+    }
+
+    static const MemoryAccount* First()
+    {
+        return s_first.load(std::memory_order_acquire);
+    }
+
+    const MemoryAccount* Next() const
+    {
+        return m_next;
+    }
+
+private:
+    static inline std::atomic<MemoryAccount*> s_first {nullptr};
+
+    const char* m_name;
+    MemoryAccount* m_next;
+    std::atomic<size_t> m_bytes[std::to_underlying(MemoryType::kValueCount)] {};
+    std::atomic<size_t> m_peak_bytes[std::to_underlying(MemoryType::kValueCount)] {};
+    std::atomic<uint32_t> m_allocations {0};
+};
+
+template <typename Tag>
+MemoryAccount&
+GetMemoryAccount()
+{
+    static MemoryAccount account(Tag::kName);
+
+    return account;
+}
+
+template <typename T, typename Tag, MemoryType type>
+mem_unique_ptr<T>
+AllocTaggedMem(unsigned alignment)
+{
+    const size_t alloc_alignment = std::max<size_t>(alignment, alignof(T));
+    auto deleter = +[](T* ptr) {
+        if (ptr != nullptr)
+        {
+            ptr->~T();
+            FreeMem(ptr);
+            GetMemoryAccount<Tag>().Remove(type, sizeof(T));
+        }
+    };
+
+    auto raw_ptr = type == MemoryType::kFast ? AllocFastMem(sizeof(T), alloc_alignment)
+                                             : AllocSlowMem(sizeof(T), alloc_alignment);
+    if (raw_ptr == nullptr)
+    {
+        return mem_unique_ptr<T>(nullptr, deleter);
+    }
+
+    GetMemoryAccount<Tag>().Add(type, sizeof(T));
+
+    return mem_unique_ptr<T>(new (raw_ptr) T(), deleter);
+}
+
+} // namespace detail
+
+/// Allocate a T in internal RAM, accounted to @a Tag
+template <typename T, typename Tag = UntaggedMemory>
+auto
+AllocFastMem(unsigned alignment = 4)
+{
+    return detail::AllocTaggedMem<T, Tag, MemoryType::kFast>(alignment);
+}
+
+/// Allocate a T in PSRAM, accounted to @a Tag
+template <typename T, typename Tag = UntaggedMemory>
+auto
+AllocSlowMem(unsigned alignment = 4)
+{
+    return detail::AllocTaggedMem<T, Tag, MemoryType::kSlow>(alignment);
+}
+
+/// The usage of @a Tag
+template <typename Tag>
+MemoryUsage
+GetMemoryUsage()
+{
+    return detail::GetMemoryAccount<Tag>().GetUsage();
+}
+
+/// Call @a on_usage with the usage of each tag which has allocated memory
+void
+ForEachMemoryUsage(auto on_usage)
+{
+    for (auto account = detail::MemoryAccount::First(); account; account = account->Next())
+    {
+        on_usage(account->GetUsage());
+    }
+}
+
+/// The heap space which is left, per MemoryType
+inline size_t
+GetFreeMemory(MemoryType type)
+{
+    return type == MemoryType::kFast ? detail::GetFreeFastMem() : detail::GetFreeSlowMem();
 }
 
-// psram
-template <typename T>
-auto AllocSlowMem(unsigned alignment = 4)
+/// Print the allocations per tag, and the free heap
+inline void
+DumpMemoryUsage()
 {
-    return detail::AllocSlowMem<T>(alignment);
+    ForEachMemoryUsage([](const MemoryUsage& usage) {
+        printf("%-16s fast %7zu (peak %7zu) slow %8zu (peak %8zu) allocations %4u\n",
+               usage.name,
+               usage.bytes[std::to_underlying(MemoryType::kFast)],
+               usage.peak_bytes[std::to_underlying(MemoryType::kFast)],
+               usage.bytes[std::to_underlying(MemoryType::kSlow)],
+               usage.peak_bytes[std::to_underlying(MemoryType::kSlow)],
+               static_cast<unsigned>(usage.allocations));
+    });
+    printf("free             fast %7zu slow %8zu\n",
+           GetFreeMemory(MemoryType::kFast),
+           GetFreeMemory(MemoryType::kSlow));
 }
 
-}
\ No newline at end of file
+} // namespace os
@@ -3,10 +3,15 @@
 #include "os_implementation.hh"
 #include "semaphore.hh"
 #include "thread_parameters.hh"
+#include "trace.hh"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <optional>
+#include <utility>
 
 class ThreadFixture;
 
@@ -19,7 +24,29 @@ public:
     // For unit tests
     friend class ::ThreadFixture;
 
-    virtual ~OsThread() = default;
+    OsThread()
+    {
+        std::lock_guard lock(s_threads_mutex);
+
+        m_next_thread = std::exchange(s_first_thread, this);
+    }
+
+    virtual ~OsThread()
+    {
+        std::lock_guard lock(s_threads_mutex);
+
+        for (auto p = &s_first_thread; *p; p = &(*p)->m_next_thread)
+        {
+            if (*p == this)
+            {
+                *p = m_next_thread;
+                break;
+            }
+        }
+    }
+
+    OsThread(const OsThread&) = delete;
+    OsThread& operator=(const OsThread&) = delete;
 
     virtual void Awake() = 0;
 
@@ -44,10 +71,15 @@ public:
     void Start(const char* name, ThreadCore core, ThreadPriority priority, uint32_t stack_size)
     {
         m_running = true;
+        m_name = name;
+        m_stack_size = stack_size;
         printf("Starting thread %s\n",
                name
 );
-        m_self = detail::StartThread(name, core, priority, stack_size, [this]() { ThreadLoop(); });
+        m_self = detail::StartThread(name, core, priority, stack_size, [this]() {
+            trace::SetThreadName(m_name);
+            ThreadLoop();
+        });
     }
 
     // The rest are just helpers for overloaded common cases
@@ -86,6 +118,49 @@ public:
         Start(name, ThreadCore::kCore0, ThreadPriority::kLow, stack_size);
     }
 
+    /**
+     * @brief Return the least free stack the thread has had, in bytes.
+     *
+     * Use it to size the stack passed to Start(). On the host, the stack is painted when
+     * the thread starts, and the use is measured against the same stack size.
+     *
+     * @return the free stack, or std::nullopt if the thread isn't running or the backend
+     * can't tell
+     */
+    std::optional<uint32_t> GetStackHighWaterMark() const
+    {
+        if (!m_running)
+        {
+            return std::nullopt;
+        }
+
+        return detail::GetStackHighWaterMark(m_self);
+    }
+
+    uint32_t GetStackSize() const
+    {
+        return m_stack_size;
+    }
+
+    /// Print the stack use of all running threads
+    static void DumpStackUsage()
+    {
+        std::lock_guard lock(s_threads_mutex);
+
+        for (auto thread = s_first_thread; thread; thread = thread->m_next_thread)
+        {
+            if (auto free = thread->GetStackHighWaterMark())
+            {
+                auto size = thread->m_stack_size;
+
+                printf("%-16s stack %6u used %6u\n",
+                       thread->m_name,
+                       static_cast<unsigned>(size),
+                       static_cast<unsigned>(size - std::min(*free, size)));
+            }
+        }
+    }
+
 protected:
     virtual void ThreadLoop() = 0;
 
@@ -94,6 +169,11 @@ protected:
         return m_running;
     }
 
+    const char* GetName() const
+    {
+        return m_name;
+    }
+
 private:
     // For unit tests
     ThreadHandle GetThreadHandle() const
@@ -101,8 +181,15 @@ private:
         return m_self;
     }
 
+    // All threads, for DumpStackUsage()
+    static inline std::mutex s_threads_mutex;
+    static inline OsThread* s_first_thread {nullptr};
+
     ThreadHandle m_self;
+    const char* m_name {""};
+    uint32_t m_stack_size {0};
     std::atomic_bool m_running {false};
+    OsThread* m_next_thread {nullptr};
 };
 
 
@@ -124,5 +211,12 @@ SuspendThread(ThreadHandle thread)
     detail::SuspendThread(thread);
 }
 
+/// The number of cores threads can be pinned to
+static inline unsigned
+GetCoreCount()
+{
+    return detail::GetCoreCount();
+}
+
 
 } // namespace os
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "timer_queue.hh"
+
+#include <array>
+#include <etl/vector.h>
+#include <optional>
+#include <utility>
+
+namespace os
+{
+
+/**
+ * @brief Timer queue backend: an intrusive binary min-heap of absolute deadlines.
+ *
+ * Insert and remove are O(log n), and the storage is a small fixed array, which
+ * suits threads with a handful of timers.
+ *
+ * @tparam Clock the time base, MillisecondClock or MicrosecondClock
+ */
+template <size_t Capacity, typename Clock = MillisecondClock>
+class TimerHeap
+{
+public:
+    using clock = Clock;
+    using duration = typename Clock::duration;
+    using index_type = detail::TimerIndex<Capacity>;
+
+    static constexpr size_t kCapacity = Capacity;
+
+    TimerHeap()
+    {
+        m_position.fill(kNotInHeap);
+    }
+
+    void Insert(index_type index, duration deadline)
+    {
+        auto heap_index = m_heap.size();
+
+        m_deadline[index] = deadline;
+        m_heap.push_back(index);
+        m_position[index] = static_cast<index_type>(heap_index);
+        SiftUp(heap_index);
+    }
+
+    void Remove(index_type index)
+    {
+        size_t heap_index = m_position[index];
+        auto last = m_heap.size() - 1;
+
+        if (heap_index != last)
+        {
+            Swap(heap_index, last);
+        }
+        m_heap.pop_back();
+        m_position[index] = kNotInHeap;
+
+        if (heap_index < m_heap.size())
+        {
+            auto moved = m_heap[heap_index];
+
+            // The moved entry can belong either above or below
+            SiftUp(heap_index);
+            SiftDown(m_position[moved]);
+        }
+    }
+
+    bool Contains(index_type index) const
+    {
+        return m_position[index] != kNotInHeap;
+    }
+
+    duration Deadline(index_type index) const
+    {
+        return m_deadline[index];
+    }
+
+    /// Return the earliest deadline, if any
+    std::optional<duration> NextDeadline() const
+    {
+        if (m_heap.empty())
+        {
+            return std::nullopt;
+        }
+
+        return m_deadline[m_heap.front()];
+    }
+
+    /// Return the timer with the earliest deadline, if any
+    std::optional<index_type> Front() const
+    {
+        if (m_heap.empty())
+        {
+            return std::nullopt;
+        }
+
+        return m_heap.front();
+    }
+
+    /// Remove and return the earliest timer if it's due at @a now
+    std::optional<index_type> PopExpired(duration now)
+    {
+        if (m_heap.empty() || detail::IsBefore(now, m_deadline[m_heap.front()]))
+        {
+            return std::nullopt;
+        }
+
+        auto index = m_heap.front();
+        Remove(index);
+
+        return index;
+    }
+
+    /// Nothing to do, deadlines are absolute
+    void Advance(duration)
+    {
+    }
+
+private:
+    static constexpr auto kNotInHeap = detail::kInvalidTimerIndex<index_type>;
+
+    bool Less(size_t a, size_t b) const
+    {
+        return detail::IsBefore(m_deadline[m_heap[a]], m_deadline[m_heap[b]]);
+    }
+
+    void Swap(size_t a, size_t b)
+    {
+        std::swap(m_heap[a], m_heap[b]);
+
+        m_position[m_heap[a]] = static_cast<index_type>(a);
+        m_position[m_heap[b]] = static_cast<index_type>(b);
+    }
+
+    void SiftUp(size_t heap_index)
+    {
+        while (heap_index > 0)
+        {
+            auto parent = (heap_index - 1) / 2;
+
+            if (!Less(heap_index, parent))
+            {
+                break;
+            }
+            Swap(heap_index, parent);
+            heap_index = parent;
+        }
+    }
+
+    void SiftDown(size_t heap_index)
+    {
+        const auto size = m_heap.size();
+
+        while (true)
+        {
+            auto smallest = heap_index;
+            auto left = 2 * heap_index + 1;
+            auto right = left + 1;
+
+            if (left < size && Less(left, smallest))
+            {
+                smallest = left;
+            }
+            if (right < size && Less(right, smallest))
+            {
+                smallest = right;
+            }
+            if (smallest == heap_index)
+            {
+                break;
+            }
+            Swap(heap_index, smallest);
+            heap_index = smallest;
+        }
+    }
+
+    etl::vector<index_type, Capacity> m_heap;
+    std::array<index_type, Capacity> m_position;
+    std::array<duration, Capacity> m_deadline {};
+};
+
+} // namespace os
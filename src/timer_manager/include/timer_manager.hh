@@ -1,35 +1,204 @@
 #pragma once
 
 #include "event_notifier.hh"
+#include "inplace_function.hh"
+#include "mailbox.hh"
+#include "thread_profile.hh"
+#include "trace.hh"
 #include "time.hh"
+#include "timer_heap.hh"
+#include "timer_wheel.hh"
 
 #include <array>
-#include <etl/bitset.h>
 #include <etl/vector.h>
-#include <functional>
 #include <optional>
+#include <utility>
 
 namespace os
 {
 
 constexpr auto kMaxTimers = 32;
+constexpr auto kTimerInboxSize = 8;
 
-class ITimer
+/// The timer callback, stored inline in the timer manager
+template <typename Duration>
+using BasicTimerCallback = InplaceFunction<std::optional<Duration>()>;
+
+using TimerCallback = BasicTimerCallback<milliseconds>;
+
+namespace detail
+{
+
+class ITimerOwner
 {
 public:
-    virtual ~ITimer() = default;
+    virtual ~ITimerOwner() = default;
+
+    virtual bool IsExpired(uint32_t index, uint32_t generation) const = 0;
 
-    virtual bool IsExpired() const = 0;
+    virtual microseconds TimeLeft(uint32_t index, uint32_t generation) const = 0;
 
-    virtual milliseconds TimeLeft() const = 0;
+    virtual void Cancel(uint32_t index, uint32_t generation) = 0;
 };
 
-using TimerHandle = std::unique_ptr<ITimer>;
+} // namespace detail
 
-class TimerManager
+/// Counters for the timer coalescing, see BasicTimerManager::GetStatistics()
+struct TimerStatistics
+{
+    /// Number of Expire() passes which fired at least one timer
+    uint32_t wakeups {0};
+    /// Number of timers fired
+    uint32_t expirations {0};
+    /// Timers with slack fired before the end of their window, in a wakeup for something else
+    uint32_t wakeups_saved {0};
+};
+
+/**
+ * @brief Handle to a timer.
+ *
+ * The timer itself lives in the timer manager, so the handle is just a reference to
+ * it. Releasing the handle will cancel the timer.
+ */
+class TimerHandle
 {
 public:
-    explicit TimerManager(IEventNotifier& notifier);
+    TimerHandle() = default;
+
+    TimerHandle(std::nullptr_t)
+    {
+    }
+
+    TimerHandle(detail::ITimerOwner* owner, uint32_t index, uint32_t generation)
+        : m_owner(owner)
+        , m_index(index)
+        , m_generation(generation)
+    {
+    }
+
+    TimerHandle(const TimerHandle&) = delete;
+    TimerHandle& operator=(const TimerHandle&) = delete;
+
+    TimerHandle(TimerHandle&& other) noexcept
+        : m_owner(std::exchange(other.m_owner, nullptr))
+        , m_index(other.m_index)
+        , m_generation(other.m_generation)
+    {
+    }
+
+    TimerHandle& operator=(TimerHandle&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_owner = std::exchange(other.m_owner, nullptr);
+            m_index = other.m_index;
+            m_generation = other.m_generation;
+        }
+
+        return *this;
+    }
+
+    TimerHandle& operator=(std::nullptr_t)
+    {
+        Reset();
+
+        return *this;
+    }
+
+    ~TimerHandle()
+    {
+        Reset();
+    }
+
+    bool IsExpired() const
+    {
+        return !m_owner || m_owner->IsExpired(m_index, m_generation);
+    }
+
+    milliseconds TimeLeft() const
+    {
+        return std::chrono::duration_cast<milliseconds>(TimeLeftUs());
+    }
+
+    microseconds TimeLeftUs() const
+    {
+        if (!m_owner)
+        {
+            return 0us;
+        }
+
+        return m_owner->TimeLeft(m_index, m_generation);
+    }
+
+    // For compatibility with the pointer-style handles
+    const TimerHandle* operator->() const
+    {
+        return this;
+    }
+
+    explicit operator bool() const
+    {
+        return m_owner != nullptr;
+    }
+
+    bool operator==(std::nullptr_t) const
+    {
+        return m_owner == nullptr;
+    }
+
+private:
+    void Reset()
+    {
+        if (m_owner)
+        {
+            std::exchange(m_owner, nullptr)->Cancel(m_index, m_generation);
+        }
+    }
+
+    detail::ITimerOwner* m_owner {nullptr};
+    uint32_t m_index {0};
+    uint32_t m_generation {0};
+};
+
+/**
+ * @brief Timer manager, with the timer queue selected at compile time.
+ *
+ * @tparam Queue the timer queue backend, e.g., TimerHeap<32> for threads with a few
+ * timers or TimerWheel<4096> for threads with very many. The clock of the queue sets
+ * the time base, e.g., TimerHeap<32, MicrosecondClock> for sub-millisecond timers.
+ *
+ * @tparam InboxCapacity the number of timers which can be posted from other threads
+ * between two Expire() calls, must be a power of two
+ *
+ * Timers and their callbacks are stored in a fixed pool, so starting and cancelling
+ * timers never allocates memory. Only Post() and PostFromIsr() may be called from
+ * other threads than the owner.
+ */
+template <typename Queue, size_t InboxCapacity = kTimerInboxSize>
+class BasicTimerManager : private detail::ITimerOwner
+{
+public:
+    using clock = typename Queue::clock;
+    using duration = typename Queue::duration;
+    using index_type = typename Queue::index_type;
+    using Callback = BasicTimerCallback<duration>;
+
+    static constexpr auto kCapacity = Queue::kCapacity;
+
+    explicit BasicTimerManager(IEventNotifier& notifier)
+        : m_notifier(notifier)
+        , m_inbox(notifier)
+    {
+        // Hand out the lowest indices first
+        for (auto i = kCapacity; i > 0; i--)
+        {
+            m_free_timers.push_back(static_cast<index_type>(i - 1));
+        }
+    }
+
+    BasicTimerManager(const BasicTimerManager&) = delete;
+    BasicTimerManager& operator=(const BasicTimerManager&) = delete;
 
     /**
      * @brief Start a timer
@@ -41,42 +210,404 @@ public:
      * @param on_timeout the function to call when the timer expires
      * @return A handle to the timer. Releasing the handle will cancel the timer
      */
-    TimerHandle StartTimer(milliseconds timeout,
-                           std::function<std::optional<milliseconds>()> on_timeout);
+    TimerHandle StartTimer(duration timeout, Callback on_timeout)
+    {
+        return StartTimer(timeout, 0ms, std::move(on_timeout));
+    }
+
+    /**
+     * @brief Start a timer which may fire anywhere in [timeout, timeout + slack]
+     *
+     * Like the WakeupConfiguration of the opportunistic semaphore, the window allows
+     * the timer to be fired together with other timers, so that the thread wakes up
+     * less often. Periodic timers keep the slack for every period.
+     *
+     * @param timeout the earliest timeout of the timer
+     * @param slack how much later than @a timeout the timer may fire
+     * @param on_timeout the function to call when the timer expires
+     * @return A handle to the timer. Releasing the handle will cancel the timer
+     */
+    TimerHandle StartTimer(duration timeout, duration slack, Callback on_timeout)
+    {
+        auto index = Allocate(timeout, slack, std::move(on_timeout));
+        if (!index)
+        {
+            return nullptr;
+        }
+
+        return TimerHandle(this, *index, m_timers[*index].generation);
+    }
+
+    /**
+     * @brief Start a timer from another thread
+     *
+     * The timer is started by the next Expire(), and the timeout counts from there.
+     * There is no handle, so the timer runs until its callback returns std::nullopt.
+     * The notifier is signalled once per batch of posted timers.
+     *
+     * @param timeout the timeout of the timer, 0ms for a deferred job
+     * @param on_timeout the function to call when the timer expires
+     * @return false if the inbox is full
+     */
+    bool Post(duration timeout, Callback on_timeout)
+    {
+        return m_inbox.Post(timeout, std::move(on_timeout));
+    }
+
+    /// Same as Post(), but from an ISR
+    bool PostFromIsr(duration timeout, Callback on_timeout)
+    {
+        return m_inbox.PostFromIsr(timeout, std::move(on_timeout));
+    }
+
+    /**
+     * @brief Fire all due timers
+     *
+     * A timer is due when its window has opened, so timers with slack are fired
+     * together with any earlier timer.
+     *
+     * @return the time until the next wakeup, which is the latest point covering the
+     * most timer windows, or std::nullopt if there are no timers
+     */
+    std::optional<duration> Expire()
+    {
+        DrainInbox();
+
+        m_in_expire = true;
+
+        auto now = clock::Now();
+        auto fired = false;
+
+        // Only the timers which are due are touched, in deadline order
+        while (auto timer_index = PopExpired(now))
+        {
+            auto& timer = m_timers[*timer_index];
+
+            m_statistics.expirations++;
+            if (!fired)
+            {
+                m_statistics.wakeups++;
+                fired = true;
+            }
+            if (timer.slack != 0ms &&
+                detail::IsBefore(now, timer.deadline + timer.slack))
+            {
+                // Fired before the end of its window: It would have needed a wakeup of its own
+                m_statistics.wakeups_saved++;
+            }
+
+            auto next = RunCallback(*timer_index);
+
+            // Wake up the task if something expires
+            m_notifier.Notify();
+
+            if (!timer.active)
+            {
+                // Released by the callback
+                continue;
+            }
+
+            if (next)
+            {
+                // Periodic timer: Set the next timeout, but don't run it again in this round
+                timer.deadline = now + *next;
+                m_pending_additions.push_back(*timer_index);
+            }
+            else
+            {
+                // Expired, so detach
+                ReleaseEntry(*timer_index);
+            }
+        }
+
+        // Nothing is due anymore, so let all queues follow the time
+        m_queue.Advance(now);
+        m_slack_queue.Advance(now);
+        m_slack_latest.Advance(now);
+
+        ActivatePendingTimers();
+
+        RemoveDeletedTimers();
+
+        m_in_expire = false;
+
+        /*
+         * Waking up at the earliest end of a window covers every window which has
+         * opened by then, and waking later would miss that window. Exact timers are
+         * windows of zero length.
+         */
+        auto next_wakeup = m_queue.NextDeadline();
+        auto latest_slack = m_slack_latest.NextDeadline();
+        if (latest_slack && (!next_wakeup || detail::IsBefore(*latest_slack, *next_wakeup)))
+        {
+            next_wakeup = latest_slack;
+        }
+
+        if (!next_wakeup)
+        {
+            return std::nullopt;
+        }
+
+        return detail::TimeUntil(*next_wakeup, now);
+    }
+
+    const TimerStatistics& GetStatistics() const
+    {
+        return m_statistics;
+    }
 
-    std::optional<milliseconds> Expire();
+#if defined(MAELIR_PROFILING)
+    /// Record the time of the timer callbacks in @a profile
+    void SetProfile(ThreadProfile& profile)
+    {
+        m_profile = &profile;
+    }
+#endif
 
 private:
-    class TimerImpl;
+    struct PostedTimer
+    {
+        PostedTimer(duration timeout, Callback on_timeout)
+            : timeout(timeout)
+            , on_timeout(std::move(on_timeout))
+        {
+        }
+
+        duration timeout;
+        Callback on_timeout;
+    };
 
     struct Entry
     {
-        std::function<std::optional<milliseconds>()> on_timeout;
-        milliseconds timeout;
-        TimerImpl* cookie;
+        Callback on_timeout;
+        // The start of the window, also kept while the timer is not in a queue
+        duration deadline;
+        duration slack;
+        // Bumped when the entry is released, to invalidate old handles
+        uint32_t generation;
+        bool active;
     };
 
-    Entry& EntryAt(uint8_t index)
+    // From detail::ITimerOwner
+    bool IsExpired(uint32_t index, uint32_t generation) const final
+    {
+        const auto& timer = m_timers[index];
+
+        return !timer.active || timer.generation != generation;
+    }
+
+    microseconds TimeLeft(uint32_t index, uint32_t generation) const final
+    {
+        if (IsExpired(index, generation))
+        {
+            return 0us;
+        }
+
+        return std::chrono::duration_cast<microseconds>(
+            detail::TimeUntil(DeadlineOf(static_cast<index_type>(index)), clock::Now()));
+    }
+
+    void Cancel(uint32_t index, uint32_t generation) final
     {
-        return m_timers[index];
+        if (!IsExpired(index, generation))
+        {
+            ReleaseEntry(static_cast<index_type>(index));
+        }
     }
 
-    void BumpTime();
+    std::optional<duration> RunCallback(index_type index)
+    {
+        trace::Scope trace_scope(trace::Event::kTimerExpiry, index);
+#if defined(MAELIR_PROFILING)
+        ProfileScope scope(m_profile, &ThreadProfile::AddTimerCallbackTime);
+#endif
 
-    void SortActiveTimers();
-    milliseconds ActivatePendingTimers(milliseconds next_wakeup);
-    void RemoveDeletedTimers();
+        return m_timers[index].on_timeout();
+    }
 
-    std::array<Entry, kMaxTimers> m_timers {};
-    etl::vector<uint8_t, kMaxTimers> m_active_timers;
+    std::optional<index_type> Allocate(duration timeout, duration slack, Callback on_timeout)
+    {
+        if (m_free_timers.empty())
+        {
+            return std::nullopt;
+        }
+
+        auto index = m_free_timers.back();
+        m_free_timers.pop_back();
+
+        auto& timer = m_timers[index];
+
+        timer.on_timeout = std::move(on_timeout);
+        timer.slack = slack;
+        timer.active = true;
+
+        auto deadline = clock::Now() + timeout;
+        if (m_in_expire)
+        {
+            // Starting the timer from the callback of another: Add to pending for later processing
+            timer.deadline = deadline;
+            m_pending_additions.push_back(index);
+        }
+        else
+        {
+            Insert(index, deadline);
+        }
+
+        return index;
+    }
+
+    void DrainInbox()
+    {
+        auto free = m_free_timers.size();
+        m_inbox.Drain(
+            [this](PostedTimer& posted) {
+                Allocate(posted.timeout, 0ms, std::move(posted.on_timeout));
+            },
+            free);
+
+        // A partial drain signals again by itself. With a full pool, the rest is left
+        // for when timers have been released, see FreeEntry()
+        m_inbox_stranded = free == 0 && !m_inbox.Empty();
+    }
+
+    duration DeadlineOf(index_type index) const
+    {
+        return m_timers[index].deadline;
+    }
+
+    void Insert(index_type index, duration deadline)
+    {
+        auto& timer = m_timers[index];
+
+        timer.deadline = deadline;
+        if (timer.slack == 0ms)
+        {
+            m_queue.Insert(index, deadline);
+        }
+        else
+        {
+            m_slack_queue.Insert(index, deadline);
+            m_slack_latest.Insert(index, deadline + timer.slack);
+        }
+    }
+
+    void Remove(index_type index)
+    {
+        if (m_queue.Contains(index))
+        {
+            m_queue.Remove(index);
+        }
+        if (m_slack_queue.Contains(index))
+        {
+            m_slack_queue.Remove(index);
+            m_slack_latest.Remove(index);
+        }
+    }
+
+    // Pop the next due timer, from whichever queue has the earliest deadline
+    std::optional<index_type> PopExpired(duration now)
+    {
+        auto exact = m_queue.NextDeadline();
+        auto slack = m_slack_queue.NextDeadline();
+
+        if (slack && (!exact || detail::IsBefore(*slack, *exact)))
+        {
+            auto index = m_slack_queue.PopExpired(now);
+            if (index)
+            {
+                m_slack_latest.Remove(*index);
+            }
+
+            return index;
+        }
+
+        return m_queue.PopExpired(now);
+    }
+
+    void ReleaseEntry(index_type index)
+    {
+        auto& timer = m_timers[index];
+
+        timer.active = false;
+        timer.generation++;
+        Remove(index);
+
+        if (m_in_expire)
+        {
+            // The callback might be executing right now, so free it afterwards
+            m_pending_removals.push_back(index);
+        }
+        else
+        {
+            FreeEntry(index);
+        }
+    }
+
+    void FreeEntry(index_type index)
+    {
+        m_timers[index].on_timeout = nullptr;
+        m_free_timers.push_back(index);
+
+        if (std::exchange(m_inbox_stranded, false))
+        {
+            // Posts may be left in the inbox, which won't signal again by itself
+            m_notifier.Notify();
+        }
+    }
+
+    void ActivatePendingTimers()
+    {
+        for (auto index : m_pending_additions)
+        {
+            auto& timer = m_timers[index];
+
+            // Skip timers released before they were activated
+            if (timer.active)
+            {
+                Insert(index, timer.deadline);
+            }
+        }
+        m_pending_additions.clear();
+    }
+
+    void RemoveDeletedTimers()
+    {
+        for (auto index : m_pending_removals)
+        {
+            FreeEntry(index);
+        }
+        m_pending_removals.clear();
+    }
+
+    std::array<Entry, kCapacity> m_timers {};
+    // Exact timers
+    Queue m_queue;
+    // Timers with slack, by start and end of their windows
+    Queue m_slack_queue;
+    Queue m_slack_latest;
 
     IEventNotifier& m_notifier;
-    milliseconds m_last_expiery;
 
-    etl::bitset<kMaxTimers, uint8_t> m_pending_removals;
-    etl::bitset<kMaxTimers, uint8_t> m_pending_additions;
-    etl::bitset<kMaxTimers, uint8_t> m_free_timers;
+    etl::vector<index_type, kCapacity> m_free_timers;
+    etl::vector<index_type, kCapacity> m_pending_removals;
+    etl::vector<index_type, kCapacity> m_pending_additions;
     bool m_in_expire {false};
+    // The inbox was drained up to the free timers, so posts may be left
+    bool m_inbox_stranded {false};
+
+    Mailbox<PostedTimer, InboxCapacity> m_inbox;
+
+    TimerStatistics m_statistics;
+
+#if defined(MAELIR_PROFILING)
+    ThreadProfile* m_profile {nullptr};
+#endif
 };
 
+/// The default timer manager, for threads with a few timers
+using TimerManager = BasicTimerManager<TimerHeap<kMaxTimers>>;
+
+// Instantiated in timer_manager.cc
+extern template class BasicTimerManager<TimerHeap<kMaxTimers>>;
+
 }; // namespace os
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "time.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace os::detail
+{
+
+/// The smallest index type which can address all timers, with one value left for "invalid"
+template <size_t Capacity>
+using TimerIndex = std::conditional_t<(Capacity < std::numeric_limits<uint8_t>::max()),
+                                      uint8_t,
+                                      std::conditional_t<(Capacity < std::numeric_limits<uint16_t>::max()),
+                                                         uint16_t,
+                                                         uint32_t>>;
+
+template <typename T>
+constexpr auto kInvalidTimerIndex = std::numeric_limits<T>::max();
+
+/// Wrap-safe comparison of two absolute timestamps
+template <typename Duration>
+constexpr bool
+IsBefore(Duration a, Duration b)
+{
+    using signed_rep = std::make_signed_t<typename Duration::rep>;
+
+    return static_cast<signed_rep>(a.count() - b.count()) < 0;
+}
+
+template <typename Duration>
+constexpr Duration
+TimeUntil(Duration deadline, Duration now)
+{
+    if (IsBefore(now, deadline))
+    {
+        return deadline - now;
+    }
+
+    return Duration(0);
+}
+
+} // namespace os::detail
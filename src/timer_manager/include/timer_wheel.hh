@@ -0,0 +1,317 @@
+#pragma once
+
+#include "timer_queue.hh"
+
+#include <algorithm>
+#include <array>
+#include <etl/bitset.h>
+#include <optional>
+
+namespace os
+{
+
+/**
+ * @brief Timer queue backend: a hierarchical hashed timing wheel.
+ *
+ * Each level has 256 slots, one level per byte of the timestamp. A timer is placed
+ * on the level of the highest byte where its deadline differs from the current time,
+ * and is cascaded to lower levels as time advances. Slots are intrusive doubly-linked
+ * lists, so insert and remove are O(1) regardless of the number of timers. The slots
+ * above level 0 cache their earliest deadline, so that NextDeadline() doesn't walk
+ * them.
+ *
+ * @tparam Clock the time base, MillisecondClock or MicrosecondClock
+ */
+template <size_t Capacity, typename Clock = MillisecondClock>
+class TimerWheel
+{
+public:
+    using clock = Clock;
+    using duration = typename Clock::duration;
+    using index_type = detail::TimerIndex<Capacity>;
+
+    static constexpr size_t kCapacity = Capacity;
+
+    TimerWheel()
+    {
+        m_location.fill(kNowhere);
+        for (auto& level : m_slots)
+        {
+            level.fill(kNone);
+        }
+    }
+
+    void Insert(index_type index, duration deadline)
+    {
+        if (Empty())
+        {
+            // The current time only moves with the timers, so it's stale after a long idle
+            // time (possibly wrapped around). There is nothing to cascade when empty
+            m_current = Clock::Now();
+        }
+        if (detail::IsBefore(deadline, m_current))
+        {
+            deadline = m_current;
+        }
+
+        m_deadline[index] = deadline;
+        Link(index);
+    }
+
+    void Remove(index_type index)
+    {
+        Unlink(index);
+    }
+
+    bool Contains(index_type index) const
+    {
+        return m_location[index] != kNowhere;
+    }
+
+    duration Deadline(index_type index) const
+    {
+        return m_deadline[index];
+    }
+
+    /// Return the earliest deadline, if any
+    std::optional<duration> NextDeadline() const
+    {
+        for (auto level = 0u; level < kLevels; level++)
+        {
+            auto slot = FirstSlot(level);
+
+            if (!slot)
+            {
+                continue;
+            }
+
+            if (level == 0)
+            {
+                // All timers in a level 0 slot expire at the same time
+                return m_deadline[m_slots[0][*slot]];
+            }
+
+            return EarliestIn(level, *slot);
+        }
+
+        return std::nullopt;
+    }
+
+    /// Remove and return the earliest timer if it's due at @a now
+    std::optional<index_type> PopExpired(duration now)
+    {
+        auto next = NextDeadline();
+
+        if (!next || detail::IsBefore(now, *next))
+        {
+            Advance(now);
+            return std::nullopt;
+        }
+
+        // Cascades the expiring timer down to level 0
+        Advance(*next);
+
+        auto index = m_slots[0][Digit(*next, 0)];
+        Unlink(index);
+
+        return index;
+    }
+
+    /**
+     * @brief Move the current time forward to @a to, which may not be past any deadline.
+     *
+     * Only the slot which @a to enters on each level needs to be cascaded, since all
+     * other timers keep the same highest differing digit.
+     */
+    void Advance(duration to)
+    {
+        if (!detail::IsBefore(m_current, to))
+        {
+            return;
+        }
+
+        auto from = m_current;
+        m_current = to;
+
+        for (auto level = kLevels - 1; level > 0; level--)
+        {
+            if ((from.count() >> (level * kSlotBits)) == (to.count() >> (level * kSlotBits)))
+            {
+                continue;
+            }
+
+            auto slot = Digit(to, level);
+            auto index = m_slots[level][slot];
+
+            m_slots[level][slot] = kNone;
+            m_occupied[level].reset(slot);
+
+            while (index != kNone)
+            {
+                auto next = m_next[index];
+
+                Link(index);
+                index = next;
+            }
+        }
+    }
+
+private:
+    using rep = typename duration::rep;
+
+    static constexpr unsigned kSlotBits = 8;
+    static constexpr unsigned kSlots = 1 << kSlotBits;
+    static constexpr unsigned kLevels = sizeof(rep);
+    static constexpr auto kNone = detail::kInvalidTimerIndex<index_type>;
+    static constexpr uint16_t kNowhere = 0xffff;
+
+    static unsigned Digit(duration time, unsigned level)
+    {
+        return (time.count() >> (level * kSlotBits)) & (kSlots - 1);
+    }
+
+    bool Empty() const
+    {
+        return std::ranges::none_of(m_occupied, [](const auto& level) { return level.any(); });
+    }
+
+    unsigned LevelOf(duration deadline) const
+    {
+        auto diff = deadline.count() ^ m_current.count();
+        auto level = 0u;
+
+        while (diff >= kSlots)
+        {
+            diff >>= kSlotBits;
+            level++;
+        }
+
+        return level;
+    }
+
+    // The first occupied slot of a level, in expiery order
+    std::optional<unsigned> FirstSlot(unsigned level) const
+    {
+        const auto& occupied = m_occupied[level];
+        auto current = Digit(m_current, level);
+
+        if (level == 0)
+        {
+            // Same higher digits as the current time, so nothing before the current slot
+            auto slot = occupied.find_next(true, current);
+            return slot != occupied.npos ? std::optional<unsigned>(slot) : std::nullopt;
+        }
+
+        // The current slot is always empty on higher levels
+        auto slot = occupied.find_next(true, current + 1);
+        if (slot == occupied.npos && level == kLevels - 1)
+        {
+            // The top level wraps around with the timestamp
+            slot = occupied.find_first(true);
+        }
+
+        return slot != occupied.npos ? std::optional<unsigned>(slot) : std::nullopt;
+    }
+
+    // The earliest deadline of an upper level slot, recomputed if its earliest timer
+    // has been removed
+    duration EarliestIn(unsigned level, unsigned slot) const
+    {
+        auto& earliest = m_earliest[level - 1][slot];
+
+        if (m_stale[level - 1].test(slot))
+        {
+            auto index = m_slots[level][slot];
+
+            earliest = m_deadline[index];
+            for (index = m_next[index]; index != kNone; index = m_next[index])
+            {
+                if (detail::IsBefore(m_deadline[index], earliest))
+                {
+                    earliest = m_deadline[index];
+                }
+            }
+            m_stale[level - 1].reset(slot);
+        }
+
+        return earliest;
+    }
+
+    void Link(index_type index)
+    {
+        auto deadline = m_deadline[index];
+        auto level = LevelOf(deadline);
+        auto slot = Digit(deadline, level);
+        auto& head = m_slots[level][slot];
+
+        if (level > 0)
+        {
+            auto& earliest = m_earliest[level - 1][slot];
+
+            if (head == kNone)
+            {
+                earliest = deadline;
+                m_stale[level - 1].reset(slot);
+            }
+            else if (detail::IsBefore(deadline, earliest))
+            {
+                earliest = deadline;
+            }
+        }
+
+        m_prev[index] = kNone;
+        m_next[index] = head;
+        if (head != kNone)
+        {
+            m_prev[head] = index;
+        }
+        head = index;
+
+        m_occupied[level].set(slot);
+        m_location[index] = static_cast<uint16_t>(level * kSlots + slot);
+    }
+
+    void Unlink(index_type index)
+    {
+        auto level = m_location[index] / kSlots;
+        auto slot = m_location[index] % kSlots;
+
+        if (m_prev[index] != kNone)
+        {
+            m_next[m_prev[index]] = m_next[index];
+        }
+        else
+        {
+            m_slots[level][slot] = m_next[index];
+        }
+        if (m_next[index] != kNone)
+        {
+            m_prev[m_next[index]] = m_prev[index];
+        }
+
+        if (m_slots[level][slot] == kNone)
+        {
+            m_occupied[level].reset(slot);
+        }
+        else if (level > 0 && m_deadline[index] == m_earliest[level - 1][slot])
+        {
+            m_stale[level - 1].set(slot);
+        }
+        m_location[index] = kNowhere;
+    }
+
+    duration m_current {Clock::Now()};
+
+    std::array<std::array<index_type, kSlots>, kLevels> m_slots;
+    std::array<etl::bitset<kSlots, uint32_t>, kLevels> m_occupied;
+    // Per slot above level 0, see EarliestIn()
+    mutable std::array<std::array<duration, kSlots>, kLevels - 1> m_earliest {};
+    mutable std::array<etl::bitset<kSlots, uint32_t>, kLevels - 1> m_stale;
+
+    std::array<index_type, Capacity> m_next {};
+    std::array<index_type, Capacity> m_prev {};
+    std::array<uint16_t, Capacity> m_location;
+    std::array<duration, Capacity> m_deadline {};
+};
+
+} // namespace os
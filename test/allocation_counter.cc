@@ -0,0 +1,101 @@
+#include "allocation_counter.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<size_t> g_allocations {0};
+
+void*
+CountedAlloc(size_t size)
+{
+    g_allocations++;
+
+    if (auto out = std::malloc(size == 0 ? 1 : size))
+    {
+        return out;
+    }
+
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+AllocationCounter::AllocationCounter()
+    : m_at_start(g_allocations.load())
+{
+}
+
+size_t
+AllocationCounter::Allocations() const
+{
+    return g_allocations.load() - m_at_start;
+}
+
+/*
+ * Replace the global operator new/delete. All non-aligned variants are replaced, since
+ * the sanitizers otherwise complain about mismatching allocators.
+ */
+void*
+operator new(size_t size)
+{
+    return CountedAlloc(size);
+}
+
+void*
+operator new[](size_t size)
+{
+    return CountedAlloc(size);
+}
+
+void*
+operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    g_allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void*
+operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    g_allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete[](void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @brief Count the heap allocations (global operator new) done during the lifetime
+ * of the object.
+ */
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+
+    size_t Allocations() const;
+
+private:
+    size_t m_at_start;
+};
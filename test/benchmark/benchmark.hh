@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace benchmark
+{
+
+struct Result
+{
+    std::string_view suite;
+    std::string_view workload;
+    std::string_view variant;
+    size_t size;
+
+    // Timer starts, expirations and cancels, or scheduler wakeups
+    uint64_t operations;
+    // Calls of the measured function, Expire() or Schedule()
+    uint64_t expires;
+
+    std::chrono::nanoseconds total_time;
+    std::chrono::nanoseconds expire_time;
+};
+
+/// Print a result as one line of JSON
+void Report(const Result& result);
+
+/// Scale the number of rounds, from the command line
+unsigned Rounds(unsigned base);
+
+void RunTimerManager();
+
+void RunOpportunisticScheduler();
+
+} // namespace benchmark
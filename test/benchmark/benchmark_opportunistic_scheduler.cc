@@ -0,0 +1,149 @@
+#include "benchmark.hh"
+#include "mock_time.hh"
+#include "opportunistic_scheduler.hh"
+
+#include <memory>
+#include <vector>
+
+using namespace os;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr auto kSemaphores = 32;
+
+/*
+ * Waiters spread over all semaphores. Half wait for an interval (pending), half with a
+ * no_earlier_than (too early). Each round advances the time 1ms, releases a few
+ * semaphores and runs the scheduler. Woken threads wait again right away, so the number
+ * of waiters stays the same.
+ */
+class Workload : public TimeFixture
+{
+public:
+    explicit Workload(size_t waiters)
+        : m_threads(waiters)
+    {
+        m_woken.reserve(waiters);
+
+        for (auto i = 0u; i < waiters; i++)
+        {
+            auto& thread = m_threads[i];
+
+            thread.handle = std::make_unique<MockThread>();
+            thread.on_awake =
+                NAMED_ALLOW_CALL(*thread.handle, Awake()).SIDE_EFFECT(m_woken.push_back(i));
+            thread.sem_index = static_cast<uint8_t>(i % kSemaphores);
+            Wait(i);
+        }
+    }
+
+    uint32_t Random()
+    {
+        m_seed = m_seed * 1103515245 + 12345;
+
+        return m_seed >> 8;
+    }
+
+    void Round(unsigned releases)
+    {
+        AdvanceTime(1ms);
+        for (auto i = 0u; i < releases; i++)
+        {
+            m_scheduler.RequestScheduleForSemaphore(Random() % kSemaphores);
+        }
+
+        auto before = Clock::now();
+        m_scheduler.Schedule();
+        m_schedule_time += Clock::now() - before;
+        m_schedules++;
+
+        for (auto index : m_woken)
+        {
+            Wait(index);
+        }
+        m_wakeups += m_woken.size();
+        m_woken.clear();
+    }
+
+    void Start()
+    {
+        m_start = Clock::now();
+    }
+
+    benchmark::Result Finish(std::string_view workload, std::string_view variant)
+    {
+        auto total = Clock::now() - m_start;
+
+        return {"opportunistic_scheduler",
+                workload,
+                variant,
+                m_threads.size(),
+                m_wakeups,
+                m_schedules,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(total),
+                m_schedule_time};
+    }
+
+private:
+    struct Thread
+    {
+        std::unique_ptr<MockThread> handle;
+        std::unique_ptr<trompeloeil::expectation> on_awake;
+        uint8_t sem_index;
+    };
+
+    void Wait(size_t index)
+    {
+        const auto& thread = m_threads[index];
+        auto latest = milliseconds(10 + Random() % 90);
+
+        if (index % 2 == 0)
+        {
+            m_scheduler.AddPendingEntry(
+                thread.handle.get(), thread.sem_index, {0ms, {latest / 2, latest}});
+        }
+        else
+        {
+            m_scheduler.AddEarlyEntry(
+                thread.handle.get(), thread.sem_index, {latest / 4, {latest / 2, latest}});
+        }
+    }
+
+    binary_semaphore m_semaphore {0};
+    OpportunisticScheduler m_scheduler {m_semaphore};
+    std::vector<Thread> m_threads;
+    std::vector<size_t> m_woken;
+    uint32_t m_seed {1};
+    uint64_t m_wakeups {0};
+    uint64_t m_schedules {0};
+    Clock::time_point m_start;
+    std::chrono::nanoseconds m_schedule_time {0};
+};
+
+benchmark::Result
+Run(std::string_view workload, size_t waiters, unsigned releases)
+{
+    Workload w(waiters);
+
+    w.Start();
+    for (auto round = benchmark::Rounds(200'000); round > 0; round--)
+    {
+        w.Round(releases);
+    }
+
+    return w.Finish(workload, "heap");
+}
+
+} // namespace
+
+void
+benchmark::RunOpportunisticScheduler()
+{
+    for (auto waiters : {8u, 16u, 32u})
+    {
+        Report(Run("timeouts", waiters, 0));
+        Report(Run("releases", waiters, 4));
+    }
+}
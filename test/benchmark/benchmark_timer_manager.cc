@@ -0,0 +1,281 @@
+#include "benchmark.hh"
+#include "mock_time.hh"
+#include "timer_manager.hh"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace os;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+class NullNotifier : public IEventNotifier
+{
+public:
+    void Notify() final
+    {
+    }
+
+    void NotifyFromIsr() final
+    {
+    }
+};
+
+/*
+ * A number of timer slots driven by the mock time. The manager has twice the capacity,
+ * so that timers restarted from callbacks always fit while the old entries are pending
+ * removal.
+ */
+template <typename Manager>
+class Workload : public TimeFixture
+{
+public:
+    explicit Workload(size_t size)
+        : m_manager(std::make_unique<Manager>(m_notifier))
+        , m_timers(size)
+    {
+    }
+
+    // Advance the time 1ms and run the timers
+    void Tick()
+    {
+        AdvanceTime(1ms);
+
+        auto before = Clock::now();
+        m_manager->Expire();
+        m_expire_time += Clock::now() - before;
+        m_expires++;
+    }
+
+    uint32_t Random()
+    {
+        m_seed = m_seed * 1103515245 + 12345;
+
+        return m_seed >> 8;
+    }
+
+    void Start()
+    {
+        m_start = Clock::now();
+    }
+
+    benchmark::Result Finish(std::string_view workload, std::string_view variant)
+    {
+        auto total = Clock::now() - m_start;
+
+        return {"timer_manager",
+                workload,
+                variant,
+                m_timers.size(),
+                m_operations,
+                m_expires,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(total),
+                m_expire_time};
+    }
+
+    std::unique_ptr<Manager> m_manager;
+    std::vector<TimerHandle> m_timers;
+    uint64_t m_operations {0};
+
+private:
+    NullNotifier m_notifier;
+    uint32_t m_seed {1};
+    uint64_t m_expires {0};
+    Clock::time_point m_start;
+    std::chrono::nanoseconds m_expire_time {0};
+};
+
+unsigned
+RoundsFor(size_t size)
+{
+    return benchmark::Rounds(std::max<unsigned>(1000, 2'000'000 / size));
+}
+
+// Single-shot timers with random timeouts, restarted when expired
+template <typename Manager>
+benchmark::Result
+OneShotChurn(std::string_view variant, size_t size)
+{
+    Workload<Manager> w(size);
+    auto& operations = w.m_operations;
+
+    w.Start();
+    for (auto round = 0u; round < RoundsFor(size); round++)
+    {
+        for (auto& timer : w.m_timers)
+        {
+            if (timer.IsExpired())
+            {
+                timer = w.m_manager->StartTimer(milliseconds(1 + w.Random() % 32), [&operations]() {
+                    operations++;
+                    return std::nullopt;
+                });
+                operations++;
+            }
+        }
+        w.Tick();
+    }
+
+    return w.Finish("one_shot_churn", variant);
+}
+
+template <typename Manager>
+benchmark::Result
+Periodic(std::string_view variant, size_t size)
+{
+    Workload<Manager> w(size);
+    auto& operations = w.m_operations;
+
+    for (auto i = 0u; i < size; i++)
+    {
+        auto period = milliseconds(1 + i % 16);
+
+        w.m_timers[i] = w.m_manager->StartTimer(period, [&operations, period]() {
+            operations++;
+            return period;
+        });
+    }
+
+    w.Start();
+    for (auto round = 0u; round < RoundsFor(size); round++)
+    {
+        w.Tick();
+    }
+
+    return w.Finish("periodic", variant);
+}
+
+// Timeouts which are mostly cancelled before they expire
+template <typename Manager>
+benchmark::Result
+CancelHeavy(std::string_view variant, size_t size)
+{
+    Workload<Manager> w(size);
+    auto& operations = w.m_operations;
+
+    w.Start();
+    for (auto round = 0u; round < RoundsFor(size); round++)
+    {
+        for (auto& timer : w.m_timers)
+        {
+            if (timer.IsExpired())
+            {
+                timer = w.m_manager->StartTimer(milliseconds(50 + w.Random() % 1000), [&operations]() {
+                    operations++;
+                    return std::nullopt;
+                });
+                operations++;
+            }
+        }
+        for (auto& timer : w.m_timers)
+        {
+            if (w.Random() % 4 != 0)
+            {
+                timer = nullptr;
+                operations++;
+            }
+        }
+        w.Tick();
+    }
+
+    return w.Finish("cancel_heavy", variant);
+}
+
+// Timers which start their successor from the callback, i.e., while expiring
+template <typename Manager>
+benchmark::Result
+StartFromCallback(std::string_view variant, size_t size)
+{
+    Workload<Manager> w(size);
+
+    struct Restarter
+    {
+        std::optional<milliseconds> operator()() const
+        {
+            w->m_timers[index] =
+                w->m_manager->StartTimer(milliseconds(1 + w->Random() % 32), *this);
+            w->m_operations += 2;
+
+            return std::nullopt;
+        }
+
+        Workload<Manager>* w;
+        size_t index;
+    };
+
+    for (auto i = 0u; i < size; i++)
+    {
+        w.m_timers[i] = w.m_manager->StartTimer(milliseconds(1 + w.Random() % 32), Restarter {&w, i});
+    }
+
+    w.Start();
+    for (auto round = 0u; round < RoundsFor(size); round++)
+    {
+        w.Tick();
+    }
+
+    return w.Finish("start_from_callback", variant);
+}
+
+// Long timeouts within a 256ms window, i.e., mostly in the same upper wheel slot
+template <typename Manager>
+benchmark::Result
+Clustered(std::string_view variant, size_t size)
+{
+    Workload<Manager> w(size);
+    auto& operations = w.m_operations;
+
+    w.Start();
+    for (auto round = 0u; round < RoundsFor(size); round++)
+    {
+        for (auto& timer : w.m_timers)
+        {
+            if (timer.IsExpired())
+            {
+                timer = w.m_manager->StartTimer(milliseconds(256 + w.Random() % 256), [&operations]() {
+                    operations++;
+                    return std::nullopt;
+                });
+                operations++;
+            }
+        }
+        w.Tick();
+    }
+
+    return w.Finish("clustered", variant);
+}
+
+template <typename Manager>
+void
+RunAll(std::string_view variant, size_t size)
+{
+    benchmark::Report(OneShotChurn<Manager>(variant, size));
+    benchmark::Report(Periodic<Manager>(variant, size));
+    benchmark::Report(CancelHeavy<Manager>(variant, size));
+    benchmark::Report(StartFromCallback<Manager>(variant, size));
+}
+
+template <size_t Size>
+void
+RunSize()
+{
+    RunAll<BasicTimerManager<TimerHeap<2 * Size>>>("heap", Size);
+    RunAll<BasicTimerManager<TimerWheel<2 * Size>>>("wheel", Size);
+}
+
+} // namespace
+
+void
+benchmark::RunTimerManager()
+{
+    RunSize<8>();
+    RunSize<64>();
+    RunSize<256>();
+    RunSize<1024>();
+
+    benchmark::Report(Clustered<BasicTimerManager<TimerHeap<2 * 4096>>>("heap", 4096));
+    benchmark::Report(Clustered<BasicTimerManager<TimerWheel<2 * 4096>>>("wheel", 4096));
+}
@@ -0,0 +1,81 @@
+#include "benchmark.hh"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+double g_scale = 1.0;
+
+double
+PerSecond(uint64_t count, std::chrono::nanoseconds time)
+{
+    if (time.count() == 0)
+    {
+        return 0;
+    }
+
+    return count * 1e9 / time.count();
+}
+
+double
+PerCall(std::chrono::nanoseconds time, uint64_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    return static_cast<double>(time.count()) / count;
+}
+
+} // namespace
+
+void
+benchmark::Report(const Result& result)
+{
+    printf("{\"suite\": \"%.*s\", \"workload\": \"%.*s\", \"variant\": \"%.*s\", \"size\": %zu, "
+           "\"operations\": %llu, \"expires\": %llu, \"ops_per_sec\": %.0f, "
+           "\"ns_per_expire\": %.1f}\n",
+           static_cast<int>(result.suite.size()),
+           result.suite.data(),
+           static_cast<int>(result.workload.size()),
+           result.workload.data(),
+           static_cast<int>(result.variant.size()),
+           result.variant.data(),
+           result.size,
+           static_cast<unsigned long long>(result.operations),
+           static_cast<unsigned long long>(result.expires),
+           PerSecond(result.operations, result.total_time),
+           PerCall(result.expire_time, result.expires));
+    fflush(stdout);
+}
+
+unsigned
+benchmark::Rounds(unsigned base)
+{
+    auto out = static_cast<unsigned>(base * g_scale);
+
+    return out > 0 ? out : 1;
+}
+
+/*
+ * Usage: benchmark_libmaelir [scale]
+ *
+ * The output is one JSON object per line. The optional scale multiplies the number of
+ * rounds, e.g., 0.1 for a quick smoke run.
+ */
+int
+main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        g_scale = std::atof(argv[1]);
+    }
+
+    benchmark::RunTimerManager();
+    benchmark::RunOpportunisticScheduler();
+
+    return 0;
+}
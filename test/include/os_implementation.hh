@@ -3,7 +3,10 @@
 #include "thread_parameters.hh"
 #include "time.hh"
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
+#include <optional>
 #include <trompeloeil/mock.hpp>
 
 namespace os
@@ -43,43 +46,62 @@ ThreadHandle StartThread(const char* name,
 
 void WaitThreadExit(ThreadHandle thread);
 
+inline unsigned
+GetCoreCount()
+{
+    // Like the ESP32
+    return 2;
+}
 
-// Unit test only
-void SetCurrentThread(ThreadHandle thread);
-std::shared_ptr<MockKernel> GetKernelMock();
+inline std::optional<uint32_t>
+GetStackHighWaterMark(ThreadHandle thread [[maybe_unused]])
+{
+    return std::nullopt;
+}
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocFastMem(unsigned alignment [[maybe_unused]])
+
+inline void*
+AllocFastMem(size_t size, size_t alignment)
 {
-    const size_t alloc_alignment = alignment > alignof(T) ? alignment : alignof(T);
-    auto deleter = +[](T* ptr) {
-        if (ptr != nullptr)
-        {
-            ptr->~T();
-            std::free(ptr);
-        }
-    };
-
-    void* raw_ptr = nullptr;
-    if (posix_memalign(&raw_ptr, alloc_alignment, sizeof(T)) != 0)
+    void* out = nullptr;
+
+    if (posix_memalign(&out, std::max(alignment, sizeof(void*)), size) != 0)
     {
-        return mem_unique_ptr<T>(nullptr, deleter);
+        return nullptr;
     }
 
-    auto* object = new (raw_ptr) T();
-    return mem_unique_ptr<T>(object, deleter);
+    return out;
 }
 
-template <typename T>
-inline mem_unique_ptr<T>
-AllocSlowMem(unsigned alignment)
+inline void*
+AllocSlowMem(size_t size, size_t alignment)
+{
+    return AllocFastMem(size, alignment);
+}
+
+inline void
+FreeMem(void* ptr)
+{
+    std::free(ptr);
+}
+
+inline size_t
+GetFreeFastMem()
+{
+    return 0;
+}
+
+inline size_t
+GetFreeSlowMem()
 {
-    // Same on Qt
-    return detail::AllocFastMem<T>(alignment);
+    return 0;
 }
 
 
+// Unit test only
+void SetCurrentThread(ThreadHandle thread);
+std::shared_ptr<MockKernel> GetKernelMock();
+
 } // namespace detail
 
 } // namespace os
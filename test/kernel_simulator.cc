@@ -0,0 +1,392 @@
+#include "kernel_simulator.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <utility>
+
+KernelSimulator::KernelSimulator() = default;
+
+KernelSimulator::~KernelSimulator() = default;
+
+void
+KernelSimulator::AddThread(os::BaseThread& thread,
+                           const char* name,
+                           os::ThreadCore core,
+                           os::ThreadPriority priority,
+                           CostFunction cost)
+{
+    auto& simulated =
+        AddKernelThread(&thread, name, core, priority, std::move(cost), thread.m_semaphore);
+
+    simulated.run_round = [&thread]() -> std::optional<microseconds> {
+        auto now = os::GetTimeStampUs();
+
+        if (auto timeout = thread.RunLoop())
+        {
+            return now + microseconds(*timeout);
+        }
+
+        return std::nullopt;
+    };
+
+    // Like the thread loop, which is not run
+    thread.m_profile.SetName(name);
+
+    os::detail::SetCurrentThread(simulated.handle.get());
+    thread.OnStartup();
+}
+
+void
+KernelSimulator::AddThread(os::BaseThread& thread,
+                           const char* name,
+                           os::ThreadCore core,
+                           os::ThreadPriority priority,
+                           microseconds cost)
+{
+    AddThread(thread, name, core, priority, [cost]() { return cost; });
+}
+
+void
+KernelSimulator::AddScheduler(os::OpportunisticScheduler& scheduler,
+                              os::binary_semaphore& semaphore,
+                              os::ThreadCore core,
+                              os::ThreadPriority priority,
+                              microseconds cost)
+{
+    assert(!m_scheduler);
+
+    auto& simulated = AddKernelThread(
+        &scheduler, "scheduler", core, priority, [cost]() { return cost; }, semaphore);
+
+    // Schedule() returns the absolute time of the next wakeup
+    simulated.run_round = [&scheduler]() -> std::optional<microseconds> {
+        if (auto next = scheduler.Schedule())
+        {
+            return microseconds(*next);
+        }
+
+        return std::nullopt;
+    };
+
+    m_scheduler = &simulated;
+}
+
+os::ThreadHandle
+KernelSimulator::GetThreadHandle(const os::BaseThread& thread) const
+{
+    auto simulated = Find(&thread);
+
+    assert(simulated);
+    return simulated->handle.get();
+}
+
+void
+KernelSimulator::RunFor(microseconds time)
+{
+    auto end = os::GetTimeStampUs() + time;
+
+    while (true)
+    {
+        // Everything which happens at the same time, including wakeups from the rounds
+        do
+        {
+            UpdateReady();
+        } while (Dispatch());
+
+        auto next = NextEvent();
+        if (!next || *next >= end)
+        {
+            break;
+        }
+
+        AdvanceTime(*next - os::GetTimeStampUs());
+
+        for (auto& core : m_cores)
+        {
+            auto thread = core.running;
+
+            if (thread && core.segment_start + thread->remaining <= *next)
+            {
+                EndSegment(core);
+                core.running = nullptr;
+                thread->in_round = false;
+                thread->state = State::kBlocked;
+            }
+        }
+    }
+
+    AdvanceTime(end - os::GetTimeStampUs());
+
+    // Account the rounds which are still running
+    for (auto& core : m_cores)
+    {
+        if (core.running)
+        {
+            EndSegment(core);
+        }
+    }
+}
+
+const KernelSimulator::ThreadStatistics&
+KernelSimulator::GetStatistics(const os::BaseThread& thread) const
+{
+    auto simulated = Find(&thread);
+
+    assert(simulated);
+    return simulated->statistics;
+}
+
+const KernelSimulator::ThreadStatistics&
+KernelSimulator::GetSchedulerStatistics() const
+{
+    assert(m_scheduler);
+
+    return m_scheduler->statistics;
+}
+
+const KernelSimulator::CoreStatistics&
+KernelSimulator::GetCoreStatistics(os::ThreadCore core) const
+{
+    return m_cores[std::to_underlying(core)].statistics;
+}
+
+void
+KernelSimulator::DumpStatistics() const
+{
+    for (const auto& thread : m_threads)
+    {
+        const auto& s = thread->statistics;
+
+        printf("%-16s core %u act %6u wakeups %6u timeouts %6u preempted %6u cpu %9llu us "
+               "latency %9llu us (max %6llu)\n",
+               s.name,
+               thread->core,
+               s.activations,
+               s.wakeups,
+               s.timeouts,
+               s.preemptions,
+               static_cast<unsigned long long>(s.cpu_time.count()),
+               static_cast<unsigned long long>(s.wakeup_latency.count()),
+               static_cast<unsigned long long>(s.max_wakeup_latency.count()));
+    }
+
+    for (auto i = 0u; i < m_cores.size(); i++)
+    {
+        const auto& s = m_cores[i].statistics;
+
+        printf("core %u busy %9llu us wakeups %6u\n",
+               i,
+               static_cast<unsigned long long>(s.busy_time.count()),
+               s.wakeups);
+    }
+}
+
+KernelSimulator::KernelThread&
+KernelSimulator::AddKernelThread(const void* owner,
+                                 const char* name,
+                                 os::ThreadCore core,
+                                 os::ThreadPriority priority,
+                                 CostFunction cost,
+                                 os::binary_semaphore& semaphore)
+{
+    assert(std::to_underlying(core) < kCores);
+    assert(!Find(owner));
+
+    auto index = m_threads.size();
+    auto& thread = *m_threads.emplace_back(std::make_unique<KernelThread>());
+
+    thread.owner = owner;
+    thread.core = std::to_underlying(core);
+    thread.priority = std::to_underlying(priority);
+    thread.cost = std::move(cost);
+    thread.semaphore = &semaphore;
+    thread.ready_since = os::GetTimeStampUs();
+    thread.statistics.name = name;
+
+    // Blocking is modelled by the simulator, so suspending only returns
+    thread.handle = std::make_unique<os::MockThread>();
+    thread.on_awake = NAMED_ALLOW_CALL(*thread.handle, Awake()).SIDE_EFFECT(OnAwake(index));
+    thread.on_suspend = NAMED_ALLOW_CALL(*thread.handle, Suspend());
+
+    return thread;
+}
+
+KernelSimulator::KernelThread*
+KernelSimulator::Find(const void* owner) const
+{
+    auto it = std::ranges::find_if(m_threads,
+                                   [owner](const auto& thread) { return thread->owner == owner; });
+
+    return it == m_threads.end() ? nullptr : it->get();
+}
+
+void
+KernelSimulator::OnAwake(size_t index)
+{
+    auto& thread = *m_threads[index];
+
+    if (!thread.pending_wakeup)
+    {
+        thread.pending_wakeup = os::GetTimeStampUs();
+    }
+}
+
+void
+KernelSimulator::UpdateReady()
+{
+    auto now = os::GetTimeStampUs();
+
+    for (auto& thread : m_threads)
+    {
+        /*
+         * The semaphore is taken as soon as it's released, also while the thread runs.
+         * The real thread would take it when the round is done, which is when it's
+         * handled here.
+         */
+        if (!thread->pending_wakeup && thread->semaphore->try_acquire())
+        {
+            thread->pending_wakeup = now;
+        }
+
+        if (thread->state != State::kBlocked)
+        {
+            continue;
+        }
+
+        if (thread->pending_wakeup)
+        {
+            thread->state = State::kReady;
+            thread->reason = Reason::kWakeup;
+            thread->ready_since = *std::exchange(thread->pending_wakeup, std::nullopt);
+        }
+        else if (thread->deadline && *thread->deadline <= now)
+        {
+            thread->state = State::kReady;
+            thread->reason = Reason::kTimeout;
+            thread->ready_since = *thread->deadline;
+        }
+    }
+}
+
+bool
+KernelSimulator::Dispatch()
+{
+    auto dispatched = false;
+
+    for (auto i = 0u; i < m_cores.size(); i++)
+    {
+        auto& core = m_cores[i];
+        KernelThread* best = nullptr;
+
+        // The highest priority, and the longest waiting among those
+        for (auto& thread : m_threads)
+        {
+            if (thread->core != i || thread->state != State::kReady)
+            {
+                continue;
+            }
+            if (!best || thread->priority > best->priority ||
+                (thread->priority == best->priority && thread->ready_since < best->ready_since))
+            {
+                best = thread.get();
+            }
+        }
+
+        if (!best || (core.running && core.running->priority >= best->priority))
+        {
+            continue;
+        }
+
+        if (core.running)
+        {
+            EndSegment(core);
+            core.running->state = State::kReady;
+            core.running->statistics.preemptions++;
+        }
+        else
+        {
+            core.statistics.wakeups++;
+        }
+
+        core.running = best;
+        core.segment_start = os::GetTimeStampUs();
+        best->state = State::kRunning;
+        if (!best->in_round)
+        {
+            BeginRound(*best);
+        }
+        dispatched = true;
+    }
+
+    return dispatched;
+}
+
+void
+KernelSimulator::BeginRound(KernelThread& thread)
+{
+    auto& statistics = thread.statistics;
+    auto latency = os::GetTimeStampUs() - thread.ready_since;
+
+    statistics.activations++;
+    if (thread.reason == Reason::kWakeup)
+    {
+        statistics.wakeups++;
+    }
+    else if (thread.reason == Reason::kTimeout)
+    {
+        statistics.timeouts++;
+    }
+    if (thread.reason != Reason::kStart)
+    {
+        statistics.wakeup_latency += latency;
+        statistics.max_wakeup_latency = std::max(statistics.max_wakeup_latency, latency);
+    }
+
+    thread.in_round = true;
+    thread.remaining = std::max(thread.cost(), microseconds(1));
+
+    os::detail::SetCurrentThread(thread.handle.get());
+    thread.deadline = thread.run_round();
+}
+
+void
+KernelSimulator::EndSegment(Core& core)
+{
+    auto now = os::GetTimeStampUs();
+    auto elapsed = std::min(now - core.segment_start, core.running->remaining);
+
+    core.running->remaining -= elapsed;
+    core.running->statistics.cpu_time += elapsed;
+    core.statistics.busy_time += elapsed;
+    core.segment_start = now;
+}
+
+std::optional<microseconds>
+KernelSimulator::NextEvent() const
+{
+    std::optional<microseconds> out;
+    auto update = [&out](microseconds time) {
+        if (!out || time < *out)
+        {
+            out = time;
+        }
+    };
+
+    for (const auto& core : m_cores)
+    {
+        if (core.running)
+        {
+            update(core.segment_start + core.running->remaining);
+        }
+    }
+    for (const auto& thread : m_threads)
+    {
+        if (thread->state == State::kBlocked && thread->deadline)
+        {
+            update(*thread->deadline);
+        }
+    }
+
+    return out;
+}
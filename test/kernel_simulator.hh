@@ -0,0 +1,198 @@
+#pragma once
+
+#include "base_thread.hh"
+#include "mock_time.hh"
+#include "opportunistic_scheduler.hh"
+#include "test.hh"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+/**
+ * @brief A simulated kernel, which runs several BaseThreads in virtual time.
+ *
+ * The threads are not started. Instead, the simulator runs their loop rounds like a
+ * strict priority kernel with one ready queue per core. A round (activation) runs
+ * instantly at the virtual time it is dispatched, and then occupies its core for the
+ * time given by the cost of the thread. A higher priority thread on the same core
+ * preempts the rest of that time.
+ *
+ * Threads wake up when their semaphore is released, when they are awoken with
+ * os::AwakeThread() (e.g., by the OpportunisticScheduler), or when the timeout
+ * returned by the round has passed. Nothing depends on the wall clock, so a scenario
+ * always gives the same statistics.
+ *
+ * @code
+ * TEST_CASE_FIXTURE(KernelSimulator, "...")
+ * {
+ *     MyThread thread;
+ *
+ *     AddThread(thread, "my_thread", os::ThreadCore::kCore0, os::ThreadPriority::kNormal, 2ms);
+ *     RunFor(10s);
+ *     REQUIRE(GetStatistics(thread).timeouts == ...);
+ * }
+ * @endcode
+ */
+class KernelSimulator : public TimeFixture
+{
+public:
+    /// Returns the CPU time of the next activation
+    using CostFunction = std::function<microseconds()>;
+
+    struct ThreadStatistics
+    {
+        const char* name {""};
+        /// Number of loop rounds
+        uint32_t activations {0};
+        /// Activations caused by a semaphore release or os::AwakeThread()
+        uint32_t wakeups {0};
+        /// Activations caused by an expired timeout
+        uint32_t timeouts {0};
+        uint32_t preemptions {0};
+        microseconds cpu_time {0};
+        /// Time from the wakeup (or timeout) to the start of the round
+        microseconds wakeup_latency {0};
+        microseconds max_wakeup_latency {0};
+    };
+
+    struct CoreStatistics
+    {
+        microseconds busy_time {0};
+        /// Number of times the core leaves idle
+        uint32_t wakeups {0};
+    };
+
+    KernelSimulator();
+
+    ~KernelSimulator();
+
+    /**
+     * @brief Run @a thread on the simulated kernel. The first round is run on the next
+     * RunFor().
+     *
+     * @param thread the thread, which must not be started
+     * @param name the name in the statistics
+     * @param core the core of the thread
+     * @param priority the (strict) priority
+     * @param cost the CPU time of each activation, at least 1us
+     */
+    void AddThread(os::BaseThread& thread,
+                   const char* name,
+                   os::ThreadCore core,
+                   os::ThreadPriority priority,
+                   CostFunction cost);
+
+    void AddThread(os::BaseThread& thread,
+                   const char* name,
+                   os::ThreadCore core,
+                   os::ThreadPriority priority,
+                   microseconds cost = 100us);
+
+    /**
+     * @brief Run @a scheduler as a thread, like OpportunisticSchedulerThread.
+     *
+     * @param scheduler the scheduler
+     * @param semaphore the semaphore @a scheduler was constructed with
+     */
+    void AddScheduler(os::OpportunisticScheduler& scheduler,
+                      os::binary_semaphore& semaphore,
+                      os::ThreadCore core,
+                      os::ThreadPriority priority,
+                      microseconds cost = 20us);
+
+    /// The handle of @a thread, e.g., for os::AwakeThread()
+    os::ThreadHandle GetThreadHandle(const os::BaseThread& thread) const;
+
+    /// Run the simulation until @a time has passed
+    void RunFor(microseconds time);
+
+    const ThreadStatistics& GetStatistics(const os::BaseThread& thread) const;
+
+    const ThreadStatistics& GetSchedulerStatistics() const;
+
+    const CoreStatistics& GetCoreStatistics(os::ThreadCore core) const;
+
+    /// Print the statistics of all threads and cores
+    void DumpStatistics() const;
+
+private:
+    static constexpr auto kCores = 2;
+
+    enum class State : uint8_t
+    {
+        kReady,
+        kRunning,
+        kBlocked,
+    };
+
+    enum class Reason : uint8_t
+    {
+        kStart,
+        kWakeup,
+        kTimeout,
+    };
+
+    struct KernelThread
+    {
+        const void* owner;
+        uint8_t core;
+        uint8_t priority;
+        CostFunction cost;
+        os::binary_semaphore* semaphore;
+        // Run one round, and return the absolute time of the next timeout
+        std::function<std::optional<microseconds>()> run_round;
+
+        std::unique_ptr<os::MockThread> handle;
+        std::unique_ptr<trompeloeil::expectation> on_awake;
+        std::unique_ptr<trompeloeil::expectation> on_suspend;
+
+        State state {State::kReady};
+        Reason reason {Reason::kStart};
+        bool in_round {false};
+        microseconds ready_since {0};
+        microseconds remaining {0};
+        std::optional<microseconds> deadline;
+        // Released or awoken, but not yet handled
+        std::optional<microseconds> pending_wakeup;
+
+        ThreadStatistics statistics;
+    };
+
+    struct Core
+    {
+        KernelThread* running {nullptr};
+        microseconds segment_start {0};
+        CoreStatistics statistics;
+    };
+
+    KernelThread& AddKernelThread(const void* owner,
+                                  const char* name,
+                                  os::ThreadCore core,
+                                  os::ThreadPriority priority,
+                                  CostFunction cost,
+                                  os::binary_semaphore& semaphore);
+
+    KernelThread* Find(const void* owner) const;
+
+    void OnAwake(size_t index);
+
+    /// Pick up releases, wakeups and timeouts at the current time
+    void UpdateReady();
+
+    /// Return true if a thread was dispatched
+    bool Dispatch();
+
+    void BeginRound(KernelThread& thread);
+
+    // Account the CPU time of the running thread up to now
+    void EndSegment(Core& core);
+
+    std::optional<microseconds> NextEvent() const;
+
+    std::vector<std::unique_ptr<KernelThread>> m_threads;
+    std::array<Core, kCores> m_cores;
+    KernelThread* m_scheduler {nullptr};
+};
@@ -18,7 +18,7 @@ TimeFixture::~TimeFixture()
 }
 
 void
-TimeFixture::AdvanceTime(milliseconds time)
+TimeFixture::AdvanceTime(microseconds time)
 {
     m_time->AdvanceTime(time);
 }
@@ -38,6 +38,15 @@ os::GetTimeStamp()
     return p->Now();
 }
 
+microseconds
+os::GetTimeStampUs()
+{
+    auto p = g_mock_time.lock();
+
+    assert(p);
+    return p->NowUs();
+}
+
 void
 os::Sleep(milliseconds delay)
 {
@@ -11,18 +11,25 @@ public:
         m_time = time;
     }
 
-    void AdvanceTime(milliseconds time)
+    void AdvanceTime(microseconds time)
     {
         m_time += time;
     }
 
-    auto Now()
+    // Truncated to 32 bits, so wraps like the real millisecond clock
+    milliseconds Now()
+    {
+        return milliseconds(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(m_time).count()));
+    }
+
+    microseconds NowUs()
     {
         return m_time;
     }
 
 private:
-    milliseconds m_time {10s};
+    microseconds m_time {10s};
 };
 
 class TimeFixture
@@ -32,7 +39,7 @@ public:
 
     ~TimeFixture();
 
-    void AdvanceTime(milliseconds time);
+    void AdvanceTime(microseconds time);
 
     void SetTime(milliseconds time);
 
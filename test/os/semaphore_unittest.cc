@@ -1,93 +1,73 @@
 #include "os/thread.hh"
 #include "semaphore.hh"
 
-#include <vector>
+#include <deque>
 
 using namespace os;
 
 namespace os
 {
+/*
+ * Single-threaded: A thread which has to wait is suspended, and the call returns as if
+ * the thread had been awoken (or timed out).
+ */
 struct Impl
 {
-    Impl(int desired)
-        : value(desired)
-    {
-    }
-
-    int value;
-    std::vector<ThreadHandle> waiting_threads;
+    int value {0};
+    std::deque<ThreadHandle> waiting_threads;
 };
 
 } // namespace os
 
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::counting_semaphore(ptrdiff_t desired) noexcept
+detail::KernelSemaphore::KernelSemaphore()
+    : m_impl(std::make_unique<Impl>())
 {
-    m_impl = std::make_unique<Impl>(desired);
 }
 
-template <ptrdiff_t least_max_value>
-counting_semaphore<least_max_value>::~counting_semaphore()
+detail::KernelSemaphore::~KernelSemaphore()
 {
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::release(ptrdiff_t update) noexcept
+detail::KernelSemaphore::Give(int32_t count)
 {
-    m_impl->value =
-        std::clamp(m_impl->value + static_cast<int>(update), 0, static_cast<int>(least_max_value));
-
-    for (auto& thread : m_impl->waiting_threads)
+    for (; count > 0 && !m_impl->waiting_threads.empty(); count--)
     {
-        os::AwakeThread(thread);
+        os::AwakeThread(m_impl->waiting_threads.front());
+        m_impl->waiting_threads.pop_front();
     }
-    m_impl->waiting_threads.clear();
+    m_impl->value += count;
 }
 
-template <ptrdiff_t least_max_value>
 bool
-counting_semaphore<least_max_value>::release_from_isr(ptrdiff_t update) noexcept
+detail::KernelSemaphore::GiveFromIsr(int32_t count)
 {
-    release(update);
+    Give(count);
 
     return false;
 }
 
-template <ptrdiff_t least_max_value>
 void
-counting_semaphore<least_max_value>::acquire() noexcept
+detail::KernelSemaphore::Take()
 {
-    if (m_impl->value == 0)
+    if (m_impl->value > 0)
     {
-        auto thread = os::GetCurrentThread();
-        os::SuspendThread(thread);
-        m_impl->waiting_threads.push_back(thread);
+        m_impl->value--;
         return;
     }
-    m_impl->value = std::clamp(m_impl->value - 1, 0, static_cast<int>(least_max_value));
-}
 
-template <ptrdiff_t least_max_value>
-bool
-counting_semaphore<least_max_value>::try_acquire() noexcept
-{
-    if (m_impl->value == 0)
-    {
-        return false;
-    }
-    m_impl->value = std::clamp(m_impl->value - 1, 0, static_cast<int>(least_max_value));
-    return true;
+    auto thread = os::GetCurrentThread();
+    os::SuspendThread(thread);
+    m_impl->waiting_threads.push_back(thread);
 }
 
-template <ptrdiff_t least_max_value>
 bool
-counting_semaphore<least_max_value>::try_acquire_for_ms(const milliseconds time)
+detail::KernelSemaphore::TakeFor(microseconds)
 {
-    auto got = try_acquire();
-    if (got)
+    if (m_impl->value > 0)
     {
+        m_impl->value--;
         return true;
     }
 
@@ -95,10 +75,3 @@ counting_semaphore<least_max_value>::try_acquire_for_ms(const milliseconds time)
 
     return false;
 }
-
-namespace os
-{
-
-template class counting_semaphore<1>;
-
-}
@@ -0,0 +1,178 @@
+#include "kernel_simulator.hh"
+#include "test.hh"
+#include "thread_profile.hh"
+#include "timer_manager.hh"
+
+#include <optional>
+#include <string_view>
+
+using namespace os;
+
+namespace
+{
+
+class SimulatedThread : public BaseThread
+{
+public:
+    std::optional<milliseconds> OnActivation() final
+    {
+        return std::nullopt;
+    }
+};
+
+class SimulatorFixture : public KernelSimulator
+{
+public:
+    SimulatedThread busy;
+    SimulatedThread worker;
+};
+
+std::optional<ThreadStatistics>
+FindStatistics(std::string_view name)
+{
+    for (const auto& statistics : GetThreadStatistics())
+    {
+        if (statistics.name == name)
+        {
+            return statistics;
+        }
+    }
+
+    return std::nullopt;
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("thread_profile");
+
+TEST_CASE_FIXTURE(TimeFixture, "a profile records the activations and their time")
+{
+    ThreadProfile profile;
+
+    for (auto time : {3ms, 1ms})
+    {
+        profile.BeginActivation();
+
+        ProfileScope scope(&profile, &ThreadProfile::AddActivationTime);
+        AdvanceTime(time);
+    }
+
+    auto& statistics = profile.GetStatistics();
+    REQUIRE(statistics.activations == 2);
+    REQUIRE(statistics.activation_time == 4ms);
+    REQUIRE(statistics.max_activation_time == 3ms);
+    REQUIRE(statistics.wakeups == 0);
+}
+
+TEST_CASE_FIXTURE(TimeFixture, "the wakeup latency counts from the first notification")
+{
+    ThreadProfile profile;
+    ProfiledNotifier<binary_semaphore> notifier(m_sem, profile);
+
+    notifier.Notify();
+    AdvanceTime(2ms);
+    notifier.NotifyFromIsr();
+    AdvanceTime(1ms);
+
+    REQUIRE(m_sem.try_acquire());
+    profile.BeginActivation();
+
+    auto& statistics = profile.GetStatistics();
+    REQUIRE(statistics.wakeups == 1);
+    REQUIRE(statistics.wakeup_latency == 3ms);
+    REQUIRE(statistics.max_wakeup_latency == 3ms);
+
+    WHEN("the next activation is on a timeout")
+    {
+        AdvanceTime(5ms);
+        profile.BeginActivation();
+
+        THEN("it is not counted as a wakeup")
+        {
+            REQUIRE(statistics.activations == 2);
+            REQUIRE(statistics.wakeups == 1);
+            REQUIRE(statistics.wakeup_latency == 3ms);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(TimeFixture, "the timer manager records the time of the timer callbacks")
+{
+    ThreadProfile profile;
+    TimerManager manager(m_sem);
+
+    manager.SetProfile(profile);
+
+    auto slow = manager.StartTimer(10ms, [this]() {
+        AdvanceTime(2ms);
+        return std::nullopt;
+    });
+    auto fast = manager.StartTimer(10ms, [this]() {
+        AdvanceTime(500us);
+        return std::nullopt;
+    });
+
+    AdvanceTime(10ms);
+    manager.Expire();
+
+    auto& statistics = profile.GetStatistics();
+    REQUIRE(statistics.timer_callbacks == 2);
+    REQUIRE(statistics.timer_callback_time == 2500us);
+    REQUIRE(statistics.max_timer_callback_time == 2ms);
+}
+
+TEST_CASE_FIXTURE(TimeFixture, "the statistics of all live profiles are listed")
+{
+    {
+        ThreadProfile gps;
+        ThreadProfile ui;
+
+        gps.SetName("gps");
+        ui.SetName("ui");
+        gps.BeginActivation();
+
+        REQUIRE(GetThreadStatistics().size() == 2);
+        REQUIRE(FindStatistics("gps")->activations == 1);
+        REQUIRE(FindStatistics("ui")->activations == 0);
+    }
+
+    REQUIRE(GetThreadStatistics().empty());
+}
+
+TEST_CASE_FIXTURE(SimulatorFixture, "a thread records the wakeups and how long it waits for the core")
+{
+    unsigned jobs = 0;
+
+    AddThread(busy, "busy", ThreadCore::kCore0, ThreadPriority::kHigh, 5ms);
+    AddThread(worker, "worker", ThreadCore::kCore0, ThreadPriority::kLow, 100us);
+    RunFor(20ms);
+
+    WHEN("both threads are awoken at the same time")
+    {
+        busy.Awake();
+        REQUIRE(worker.Post([&jobs]() {
+            jobs++;
+            return std::nullopt;
+        }));
+        RunFor(20ms);
+
+        THEN("the worker waits for the higher priority thread")
+        {
+            auto statistics = FindStatistics("worker");
+
+            REQUIRE(jobs == 1);
+            REQUIRE(statistics);
+            // The start, the wakeup, and the round which runs the posted job
+            REQUIRE(statistics->activations == 3);
+            REQUIRE(statistics->wakeups == 1);
+            REQUIRE(statistics->wakeup_latency == 5ms);
+            REQUIRE(statistics->timer_callbacks == 1);
+        }
+        AND_THEN("the higher priority thread runs immediately")
+        {
+            REQUIRE(FindStatistics("busy")->wakeup_latency == 0us);
+        }
+    }
+}
+
+TEST_SUITE_END();
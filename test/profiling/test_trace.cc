@@ -0,0 +1,190 @@
+#include "mock_time.hh"
+#include "test.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace os::trace;
+
+namespace
+{
+
+class TraceFixture : public TimeFixture
+{
+public:
+    TraceFixture()
+    {
+        strcpy(state->buffers[1].name, "gps");
+    }
+
+    // Record @a count instants on the gps buffer, 1ms apart
+    void Record(unsigned count)
+    {
+        for (auto i = 0u; i < count; i++)
+        {
+            AdvanceTime(1ms);
+            detail::Write(&state->buffers[1], Event::kTimerExpiry, Phase::kInstant, i);
+        }
+    }
+
+    std::unique_ptr<TraceState> state {
+        new TraceState {kTraceMagic, kTraceVersion, kTraceEvents, 2, {}}};
+};
+
+std::string
+Export(const TraceState& state, bool* ok = nullptr)
+{
+    auto file = tmpfile();
+    REQUIRE(file);
+
+    auto rv = ExportChromeJson(state, file);
+    if (ok)
+    {
+        *ok = rv;
+    }
+
+    std::string out(ftell(file), '\0');
+    rewind(file);
+    REQUIRE(fread(out.data(), 1, out.size(), file) == out.size());
+    fclose(file);
+
+    return out;
+}
+
+/// The "arg" of all events, in the order of the JSON
+std::vector<unsigned>
+Args(const std::string& json)
+{
+    std::vector<unsigned> out;
+    constexpr auto kArg = "\"arg\":";
+
+    for (auto pos = json.find(kArg); pos != std::string::npos; pos = json.find(kArg, pos + 1))
+    {
+        out.push_back(std::stoul(json.substr(pos + strlen(kArg))));
+    }
+
+    return out;
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("trace");
+
+TEST_CASE_FIXTURE(TraceFixture, "the trace is exported as Chrome JSON")
+{
+    auto start = static_cast<unsigned long>(os::GetTimeStampUs().count());
+
+    detail::Write(&state->buffers[1], Event::kActivation, Phase::kBegin, 7);
+    AdvanceTime(2ms);
+    detail::Write(&state->buffers[1], Event::kActivation, Phase::kEnd, 7);
+
+    auto json = Export(*state);
+
+    REQUIRE(json.starts_with("{\"traceEvents\":["));
+    REQUIRE(json.ends_with("\n]}\n"));
+    REQUIRE(json.find("\"tid\":0,\"args\":{\"name\":\"isr\"}") != std::string::npos);
+    REQUIRE(json.find("\"tid\":1,\"args\":{\"name\":\"gps\"}") != std::string::npos);
+    REQUIRE(json.find("{\"name\":\"activation\",\"ph\":\"B\",\"ts\":" + std::to_string(start) +
+                      ",\"pid\":0,\"tid\":1") != std::string::npos);
+    REQUIRE(json.find("{\"name\":\"activation\",\"ph\":\"E\",\"ts\":" +
+                      std::to_string(start + 2000)) != std::string::npos);
+    REQUIRE(Args(json) == std::vector<unsigned> {7, 7});
+}
+
+TEST_CASE_FIXTURE(TraceFixture, "a wrapped ring buffer is exported oldest first")
+{
+    Record(kTraceEvents + 3);
+
+    auto args = Args(Export(*state));
+
+    REQUIRE(args.size() == kTraceEvents);
+    REQUIRE(args.front() == 3);
+    REQUIRE(args.back() == kTraceEvents + 2);
+    REQUIRE(std::ranges::is_sorted(args));
+}
+
+TEST_CASE_FIXTURE(TraceFixture, "states of another format are rejected")
+{
+    bool ok = true;
+
+    Record(2);
+
+    SUBCASE("wrong magic")
+    {
+        state->magic = 0;
+    }
+    SUBCASE("wrong version")
+    {
+        state->version = kTraceVersion + 1;
+    }
+    SUBCASE("wrong buffer size")
+    {
+        state->events_per_buffer = kTraceEvents / 2;
+    }
+
+    auto json = Export(*state, &ok);
+
+    REQUIRE_FALSE(ok);
+    REQUIRE(json.empty());
+}
+
+TEST_CASE_FIXTURE(TraceFixture, "a raw dump exports the same as the live state")
+{
+    std::vector<uint8_t> raw;
+
+    Record(kTraceEvents + 1);
+    DumpRaw(*state, [&raw](const uint8_t* data, size_t size) {
+        raw.insert(raw.end(), data, data + size);
+    });
+
+    // As read back on the host
+    REQUIRE(raw.size() == sizeof(TraceState));
+    auto copy = std::make_unique<TraceState>();
+    memcpy(static_cast<void*>(copy.get()), raw.data(), raw.size());
+
+    bool ok = false;
+    REQUIRE(Export(*copy, &ok) == Export(*state));
+    REQUIRE(ok);
+}
+
+TEST_CASE_FIXTURE(TimeFixture, "threads beyond the buffers are not traced")
+{
+    // Each thread keeps its buffer, so take all which are left
+    for (auto i = 0; i <= kMaxTracedThreads; i++)
+    {
+        std::thread([i]() {
+            auto name = "thread" + std::to_string(i);
+
+            SetThreadName(name.c_str());
+            Instant(Event::kSchedule, 1000 + i);
+        }).join();
+    }
+
+    REQUIRE(g_trace_state.buffer_count == kMaxTracedThreads);
+
+    WHEN("another thread writes events")
+    {
+        std::thread([]() {
+            SetThreadName("dropped");
+            Instant(Event::kSchedule, 2000);
+        }).join();
+
+        THEN("they are dropped, and the other buffers are kept")
+        {
+            auto json = Export(g_trace_state);
+
+            REQUIRE(g_trace_state.buffer_count == kMaxTracedThreads);
+            REQUIRE(json.find("dropped") == std::string::npos);
+            REQUIRE(json.find("\"arg\":2000") == std::string::npos);
+            REQUIRE(json.find("\"arg\":1000") != std::string::npos);
+        }
+    }
+}
+
+TEST_SUITE_END();
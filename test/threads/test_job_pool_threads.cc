@@ -0,0 +1,150 @@
+#include "job_pool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <doctest/doctest.h>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace os;
+
+TEST_SUITE_BEGIN("job_pool_threads");
+
+namespace
+{
+
+constexpr auto kRounds = 200;
+
+// Keep a job busy long enough to let the other workers steal
+void
+Spin()
+{
+    volatile auto sink = 0;
+
+    for (auto i = 0; i < 1000; i++)
+    {
+        sink = i;
+    }
+}
+
+} // namespace
+
+TEST_CASE("a pool with workers runs a parallel for on all threads")
+{
+    JobPool pool(4);
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+
+    for (auto round = 0; round < kRounds; round++)
+    {
+        std::vector<std::atomic<int>> visits(1000);
+        std::atomic<int> chunks {0};
+
+        pool.ParallelFor(visits.size(), 7, [&](size_t begin, size_t end) {
+            chunks++;
+            for (auto i = begin; i < end; i++)
+            {
+                visits[i]++;
+            }
+            Spin();
+
+            std::scoped_lock lock(mutex);
+            threads.insert(std::this_thread::get_id());
+        });
+
+        REQUIRE(chunks == 143);
+        REQUIRE(std::ranges::all_of(visits, [](auto& count) { return count == 1; }));
+    }
+
+    // The jobs are spread over the workers, not only run by the caller
+    REQUIRE(threads.size() > 1);
+}
+
+TEST_CASE("a pool with workers runs task graphs in dependency order")
+{
+    JobPool pool(3);
+
+    TaskGraph graph;
+    std::atomic<int> stage {0};
+    std::atomic<int> middle {0};
+    std::atomic<bool> in_order {true};
+
+    auto load = graph.Add([&]() { stage = 1; });
+    auto join = graph.Add([&]() {
+        in_order = in_order && middle == 8;
+        stage = 2;
+    });
+
+    for (auto i = 0; i < 8; i++)
+    {
+        auto task = graph.Add([&]() {
+            in_order = in_order && stage == 1;
+            Spin();
+            middle++;
+        });
+
+        graph.Precede(load, task);
+        graph.Precede(task, join);
+    }
+
+    for (auto round = 0; round < kRounds; round++)
+    {
+        stage = 0;
+        middle = 0;
+
+        pool.Run(graph);
+
+        REQUIRE(stage == 2);
+        REQUIRE(middle == 8);
+    }
+    REQUIRE(in_order);
+}
+
+TEST_CASE("nested parallel fors are stolen from the submitting worker")
+{
+    JobPool pool(4);
+
+    for (auto round = 0; round < kRounds / 4; round++)
+    {
+        std::atomic<int> inner {0};
+
+        // Each outer job waits for its own inner jobs, which go to the deque of its worker
+        pool.ParallelFor(4, 1, [&](size_t, size_t) {
+            pool.ParallelFor(32, 1, [&](size_t, size_t) {
+                Spin();
+                inner++;
+            });
+        });
+
+        REQUIRE(inner == 4 * 32);
+    }
+}
+
+TEST_CASE("runs from several threads share the pool")
+{
+    JobPool pool(2);
+
+    std::atomic<int> total {0};
+    std::vector<std::thread> callers;
+
+    for (auto i = 0; i < 4; i++)
+    {
+        callers.emplace_back([&pool, &total]() {
+            for (auto round = 0; round < kRounds; round++)
+            {
+                pool.ParallelFor(16, 1, [&total](size_t, size_t) { total++; });
+            }
+        });
+    }
+    for (auto& caller : callers)
+    {
+        caller.join();
+    }
+
+    REQUIRE(total == 4 * kRounds * 16);
+}
+
+TEST_SUITE_END();
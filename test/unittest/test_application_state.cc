@@ -0,0 +1,209 @@
+#include "allocation_counter.hh"
+#include "application_state.hh"
+#include "test.hh"
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+
+GpsData
+Fix(float value)
+{
+    return GpsData {{value, value}, value, value};
+}
+
+bool
+IsConsistent(const GpsData& data)
+{
+    return data.position.longitude == data.position.latitude &&
+           data.speed == data.position.latitude && data.heading == data.position.latitude;
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("application_state");
+
+TEST_CASE("struct parameters are read and written by value")
+{
+    ApplicationState state;
+    auto rw = state.CheckoutReadWrite();
+    ApplicationState::PartialReadOnlyCache<AS::position, AS::gps_position_valid> cache(state);
+
+    REQUIRE(rw.Get<AS::position>() == Fix(0));
+    REQUIRE(rw.Get<AS::device_name>() == "maelir");
+
+    WHEN("the position is written")
+    {
+        rw.Set<AS::position>(Fix(1));
+
+        THEN("the new value is read back")
+        {
+            REQUIRE(rw.Get<AS::position>() == Fix(1));
+        }
+        AND_THEN("a cache sees it as changed on the next pull")
+        {
+            const auto& checkout = cache.Pull();
+
+            REQUIRE(checkout.IsChanged<AS::position>());
+            REQUIRE_FALSE(checkout.IsChanged<AS::gps_position_valid>());
+            REQUIRE(checkout.Get<AS::position>() == Fix(1));
+            REQUIRE_FALSE(cache.Pull().IsChanged<AS::position>());
+        }
+    }
+
+    WHEN("a snapshot writes a string parameter")
+    {
+        {
+            auto snapshot = state.CheckoutPartialSnapshot<AS::device_name, AS::position>();
+
+            snapshot.Set<AS::device_name>(std::string("boat"));
+            REQUIRE(snapshot.Get<AS::position>() == Fix(0));
+        }
+
+        THEN("it is written back on destruction")
+        {
+            REQUIRE(rw.Get<AS::device_name>() == "boat");
+        }
+    }
+}
+
+TEST_CASE("a cache only pulls the parameters which have been written")
+{
+    ApplicationState state;
+    auto rw = state.CheckoutReadWrite();
+    ApplicationState::PartialReadOnlyCache<AS::position, AS::gps_position_valid> cache(state);
+
+    REQUIRE_FALSE(cache.Pull().IsChanged<AS::position>());
+
+    WHEN("one parameter is written several times between pulls")
+    {
+        rw.Set<AS::gps_position_valid>(true);
+        rw.Set<AS::position>(Fix(1));
+        cache.Pull();
+        rw.Set<AS::position>(Fix(2));
+        rw.Set<AS::position>(Fix(3));
+
+        THEN("the change is from the last pulled value to the latest one")
+        {
+            GpsData from {};
+            GpsData to {};
+
+            const auto& checkout = cache.Pull();
+            checkout.OnChangedValue<AS::position>([&from, &to](const auto& old_value,
+                                                              const auto& new_value) {
+                from = old_value;
+                to = new_value;
+            });
+
+            REQUIRE(from == Fix(1));
+            REQUIRE(to == Fix(3));
+            REQUIRE_FALSE(checkout.IsChanged<AS::gps_position_valid>());
+            REQUIRE(checkout.Get<AS::gps_position_valid>());
+        }
+    }
+
+    WHEN("a parameter is written back to the pulled value")
+    {
+        rw.Set<AS::position>(Fix(1));
+        rw.Set<AS::position>(Fix(0));
+
+        THEN("it is not changed")
+        {
+            REQUIRE_FALSE(cache.Pull().IsChanged<AS::position>());
+            REQUIRE(cache.Pull().Get<AS::position>() == Fix(0));
+        }
+    }
+}
+
+TEST_CASE("non-atomic parameters are written without allocations")
+{
+    ApplicationState state;
+    auto rw = state.CheckoutReadWrite();
+    ApplicationState::PartialReadOnlyCache<AS::position> cache(state);
+
+    // Longer than the small string buffer
+    rw.Set<AS::device_name>(std::string(64, 'a'));
+
+    const std::string other_name(64, 'b');
+    AllocationCounter counter;
+
+    WHEN("the position is written and pulled at a high rate")
+    {
+        for (auto i = 1; i <= 100; i++)
+        {
+            rw.Set<AS::position>(Fix(static_cast<float>(i)));
+            cache.Pull();
+        }
+
+        THEN("nothing is allocated")
+        {
+            REQUIRE(counter.Allocations() == 0);
+            REQUIRE(cache.Pull().Get<AS::position>() == Fix(100));
+        }
+    }
+
+    WHEN("a string is replaced with one which fits its capacity")
+    {
+        rw.Set<AS::device_name>(other_name);
+
+        THEN("it is written in place")
+        {
+            REQUIRE(counter.Allocations() == 0);
+            REQUIRE(rw.Get<AS::device_name>() == other_name);
+        }
+    }
+
+    WHEN("a string is read into a buffer or in place")
+    {
+        std::string name(64, 'c');
+        auto matches = false;
+        AllocationCounter read_counter;
+
+        rw.Get<AS::device_name>(name);
+        rw.Read<AS::device_name>(
+            [&matches, &name](const std::string& value) { matches = value == name; });
+
+        THEN("it is not copied to a new string")
+        {
+            REQUIRE(read_counter.Allocations() == 0);
+            REQUIRE(name == std::string(64, 'a'));
+            REQUIRE(matches);
+        }
+    }
+}
+
+TEST_CASE("a reader never sees a partially written struct parameter")
+{
+    ApplicationState state;
+    ApplicationState::PartialReadOnlyCache<AS::position> cache(state);
+    std::atomic<bool> done {false};
+
+    std::thread writer([&state, &done]() {
+        auto rw = state.CheckoutReadWrite();
+
+        for (auto i = 1; i <= 20000; i++)
+        {
+            rw.Set<AS::position>(Fix(static_cast<float>(i)));
+        }
+        done = true;
+    });
+
+    auto torn = 0;
+    auto reads = 0;
+    while (!done || reads == 0)
+    {
+        if (!IsConsistent(cache.Pull().Get<AS::position>()))
+        {
+            torn++;
+        }
+        reads++;
+    }
+    writer.join();
+
+    REQUIRE(torn == 0);
+    REQUIRE(cache.Pull().Get<AS::position>() == Fix(20000));
+}
+
+TEST_SUITE_END();
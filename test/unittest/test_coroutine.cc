@@ -0,0 +1,215 @@
+#include "coroutine.hh"
+#include "mock_time.hh"
+#include "test.hh"
+#include "timer_manager.hh"
+
+#include <optional>
+#include <vector>
+
+using namespace os;
+
+namespace
+{
+
+class Fixture : public TimeFixture
+{
+public:
+    // As the BaseThread loop does it
+    void RunLoop()
+    {
+        scheduler.RunReady();
+        manager.Expire();
+    }
+
+    auto SleepFor(milliseconds timeout)
+    {
+        return SleepAwaiter<TimerManager>(manager, scheduler, timeout);
+    }
+
+    TimerManager manager {m_sem};
+    CoroutineScheduler scheduler {m_sem};
+    std::vector<int> steps;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("coroutine");
+
+TEST_CASE_FIXTURE(Fixture, "a coroutine can sleep on the thread timers")
+{
+    auto coroutine = [this]() -> Task {
+        steps.push_back(0);
+        co_await SleepFor(10ms);
+        steps.push_back(1);
+        co_await SleepFor(5ms);
+        steps.push_back(2);
+    };
+
+    auto task = coroutine();
+    REQUIRE(steps == std::vector<int> {0});
+    REQUIRE_FALSE(task.Done());
+
+    AdvanceTime(9ms);
+    RunLoop();
+    RunLoop();
+    REQUIRE(steps == std::vector<int> {0});
+
+    WHEN("the timeout expires")
+    {
+        AdvanceTime(1ms);
+        RunLoop();
+
+        THEN("the coroutine is resumed on the next round of the loop")
+        {
+            REQUIRE(steps == std::vector<int> {0});
+            RunLoop();
+            REQUIRE(steps == std::vector<int> {0, 1});
+        }
+
+        AND_WHEN("the second timeout expires")
+        {
+            RunLoop();
+            AdvanceTime(5ms);
+            RunLoop();
+            RunLoop();
+
+            THEN("the coroutine completes")
+            {
+                REQUIRE(steps == std::vector<int> {0, 1, 2});
+                REQUIRE(task.Done());
+            }
+        }
+    }
+
+    WHEN("the task is destroyed while sleeping")
+    {
+        task = Task();
+        AdvanceTime(100ms);
+        RunLoop();
+        RunLoop();
+
+        THEN("the timer is cancelled")
+        {
+            REQUIRE(steps == std::vector<int> {0});
+            REQUIRE(manager.Expire() == std::nullopt);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "a coroutine doesn't sleep when the timer pool is full")
+{
+    std::vector<TimerHandle> timers;
+    std::optional<bool> slept;
+
+    for (auto i = 0; i < kMaxTimers; i++)
+    {
+        timers.push_back(manager.StartTimer(1s, []() { return std::nullopt; }));
+    }
+
+    auto coroutine = [this, &slept]() -> Task {
+        slept = co_await SleepFor(10ms);
+        steps.push_back(1);
+    };
+
+    auto task = coroutine();
+
+    THEN("the coroutine is resumed immediately, and told so")
+    {
+        REQUIRE(slept == false);
+        REQUIRE(steps == std::vector<int> {1});
+        REQUIRE(task.Done());
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "events are kept when the ready coroutines fill the scheduler")
+{
+    CoroutineEvent event(scheduler);
+    std::vector<Task> sleepers;
+
+    // The parameter is copied to the coroutine frame, unlike the captures
+    auto sleeper = [this](int i) -> Task {
+        co_await SleepFor(10ms);
+        steps.push_back(i);
+    };
+    auto coroutine = [this, &event]() -> Task {
+        co_await event;
+        steps.push_back(-1);
+    };
+
+    for (auto i = 0; i < kMaxSuspendedCoroutines; i++)
+    {
+        sleepers.push_back(sleeper(i));
+    }
+    auto waiter = coroutine();
+
+    AdvanceTime(10ms);
+    manager.Expire();
+    event.Notify();
+
+    WHEN("the ready coroutines are run")
+    {
+        scheduler.RunReady();
+
+        THEN("the sleepers are resumed first")
+        {
+            REQUIRE(steps.size() == kMaxSuspendedCoroutines);
+            REQUIRE_FALSE(waiter.Done());
+        }
+
+        AND_WHEN("the next round runs")
+        {
+            scheduler.RunReady();
+
+            THEN("the event is not lost")
+            {
+                REQUIRE(steps.back() == -1);
+                REQUIRE(waiter.Done());
+            }
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "a coroutine can wait for an event")
+{
+    CoroutineEvent event(scheduler);
+
+    auto coroutine = [this, &event]() -> Task {
+        while (true)
+        {
+            co_await event;
+            steps.push_back(1);
+        }
+    };
+
+    auto task = coroutine();
+    RunLoop();
+    REQUIRE(steps.empty());
+
+    WHEN("the event is notified several times")
+    {
+        REQUIRE_FALSE(m_sem.try_acquire());
+        event.Notify();
+        event.Notify();
+
+        THEN("the thread is awoken, and the coroutine is resumed once")
+        {
+            REQUIRE(m_sem.try_acquire());
+            RunLoop();
+            RunLoop();
+            REQUIRE(steps == std::vector<int> {1});
+        }
+    }
+
+    WHEN("the event is notified before the co_await")
+    {
+        event.Notify();
+        RunLoop();
+        event.NotifyFromIsr();
+        RunLoop();
+
+        THEN("no notification is lost")
+        {
+            REQUIRE(steps == std::vector<int> {1, 1});
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#include "event_flags.hh"
+#include "kernel_simulator.hh"
+#include "test.hh"
+
+#include <vector>
+
+using namespace os;
+
+namespace
+{
+
+class CountingNotifier : public IEventNotifier
+{
+public:
+    void Notify() final
+    {
+        notifications++;
+    }
+
+    void NotifyFromIsr() final
+    {
+        isr_notifications++;
+    }
+
+    unsigned notifications {0};
+    unsigned isr_notifications {0};
+};
+
+class MultiSourceThread : public BaseThread
+{
+public:
+    enum Source
+    {
+        kCan,
+        kGps,
+    };
+
+    std::optional<milliseconds> OnActivation(EventMask events) final
+    {
+        activations.push_back(events);
+
+        return std::nullopt;
+    }
+
+    EventSource can_event {GetEventFlags(), kCan};
+    EventSource gps_event {GetEventFlags(), kGps};
+    std::vector<EventMask> activations;
+};
+
+class SimulatorFixture : public KernelSimulator
+{
+public:
+    MultiSourceThread thread;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("event_flags");
+
+TEST_CASE("each event source sets its own bit")
+{
+    CountingNotifier notifier;
+    EventFlags flags {notifier};
+    EventSource can {flags, 0};
+    EventSource touch {flags, 5};
+
+    REQUIRE(flags.Take() == 0);
+
+    WHEN("a source is notified")
+    {
+        touch.Notify();
+
+        THEN("the thread is notified with its bit")
+        {
+            REQUIRE(notifier.notifications == 1);
+            REQUIRE(flags.Take() == EventSource::Bit(5));
+        }
+        AND_THEN("the bits are cleared on take")
+        {
+            flags.Take();
+            REQUIRE(flags.Take() == 0);
+        }
+    }
+
+    WHEN("sources are notified several times before the thread runs")
+    {
+        can.Notify();
+        can.NotifyFromIsr();
+        touch.NotifyFromIsr();
+        touch.Notify();
+
+        THEN("the thread is only notified when a bit is set")
+        {
+            REQUIRE(notifier.notifications == 1);
+            REQUIRE(notifier.isr_notifications == 1);
+            REQUIRE(flags.Take() == (can.Mask() | touch.Mask()));
+        }
+        AND_WHEN("a source is notified after the take")
+        {
+            flags.Take();
+            can.Notify();
+
+            THEN("the thread is notified again")
+            {
+                REQUIRE(notifier.notifications == 2);
+            }
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(SimulatorFixture, "a thread activation gets the mask of the fired sources")
+{
+    AddThread(thread, "thread", ThreadCore::kCore0, ThreadPriority::kNormal);
+    RunFor(1ms);
+
+    REQUIRE(thread.activations.size() == 1);
+    REQUIRE(thread.activations[0] == 0);
+
+    WHEN("a source fires")
+    {
+        thread.gps_event.Notify();
+        RunFor(1ms);
+
+        THEN("the thread runs with its bit")
+        {
+            REQUIRE(thread.activations.size() == 2);
+            REQUIRE(thread.activations[1] == thread.gps_event.Mask());
+        }
+    }
+
+    WHEN("both sources fire, once from an ISR")
+    {
+        thread.can_event.NotifyFromIsr();
+        thread.gps_event.Notify();
+        RunFor(1ms);
+
+        THEN("the thread runs once, with both bits")
+        {
+            REQUIRE(thread.activations.size() == 2);
+            REQUIRE(thread.activations[1] == (thread.can_event.Mask() | thread.gps_event.Mask()));
+        }
+    }
+
+    WHEN("the thread is awoken without a source")
+    {
+        thread.Awake();
+        RunFor(1ms);
+
+        THEN("the mask is empty")
+        {
+            REQUIRE(thread.activations.size() == 2);
+            REQUIRE(thread.activations[1] == 0);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#include "job_pool.hh"
+#include "test.hh"
+
+#include <algorithm>
+#include <vector>
+
+using namespace os;
+
+TEST_SUITE_BEGIN("job_pool");
+
+TEST_CASE("a pool without workers runs the jobs in the caller")
+{
+    JobPool pool(0);
+
+    WHEN("a range is split in chunks")
+    {
+        std::vector<int> visits(100, 0);
+        auto chunks = 0;
+
+        pool.ParallelFor(100, 8, [&visits, &chunks](size_t begin, size_t end) {
+            chunks++;
+            for (auto i = begin; i < end; i++)
+            {
+                visits[i]++;
+            }
+        });
+
+        THEN("each item is visited once")
+        {
+            REQUIRE(chunks == 13);
+            REQUIRE(std::ranges::all_of(visits, [](auto count) { return count == 1; }));
+        }
+    }
+
+    WHEN("a task graph is run")
+    {
+        TaskGraph graph;
+        std::vector<int> order;
+
+        auto load = graph.Add([&order]() { order.push_back(0); });
+        auto left = graph.Add([&order]() { order.push_back(1); });
+        auto right = graph.Add([&order]() { order.push_back(2); });
+        auto join = graph.Add([&order]() { order.push_back(3); });
+
+        graph.Precede(load, left);
+        graph.Precede(load, right);
+        graph.Precede(left, join);
+        graph.Precede(right, join);
+
+        pool.Run(graph);
+
+        THEN("the tasks run after their predecessors")
+        {
+            REQUIRE(order.size() == 4);
+            REQUIRE(order.front() == 0);
+            REQUIRE(order.back() == 3);
+        }
+
+        AND_THEN("the graph can be run again")
+        {
+            pool.Run(graph);
+            REQUIRE(order.size() == 8);
+            REQUIRE(order[4] == 0);
+            REQUIRE(order.back() == 3);
+        }
+    }
+}
+
+TEST_CASE("runs nested deeper than the waits of the pool run in the caller")
+{
+    JobPool pool(0);
+
+    auto innermost = 0;
+    InplaceFunction<void(size_t)> nest = [&](size_t depth) {
+        if (depth == 0)
+        {
+            innermost++;
+            return;
+        }
+        pool.ParallelFor(1, 1, [&nest, depth](size_t, size_t) { nest(depth - 1); });
+    };
+
+    nest(kMaxJobPoolWaits + 2);
+
+    REQUIRE(innermost == 1);
+}
@@ -0,0 +1,157 @@
+#include "kernel_simulator.hh"
+#include "test.hh"
+
+#include <functional>
+#include <vector>
+
+namespace
+{
+
+class SimulatedThread : public os::BaseThread
+{
+public:
+    std::optional<milliseconds> OnActivation() final
+    {
+        activations.push_back(os::GetTimeStamp());
+
+        return on_activation();
+    }
+
+    std::function<std::optional<milliseconds>()> on_activation = []() {
+        return std::optional<milliseconds>();
+    };
+    std::vector<milliseconds> activations;
+};
+
+class SimulatorFixture : public KernelSimulator
+{
+public:
+    milliseconds start {os::GetTimeStamp()};
+    SimulatedThread t1;
+    SimulatedThread t2;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("kernel_simulator");
+
+TEST_CASE_FIXTURE(SimulatorFixture, "a periodic thread wakes up on its timeouts")
+{
+    t1.on_activation = []() { return 10ms; };
+    AddThread(t1, "t1", os::ThreadCore::kCore0, os::ThreadPriority::kNormal, 1ms);
+
+    RunFor(100ms);
+
+    THEN("it runs every 10ms, in virtual time")
+    {
+        REQUIRE(t1.activations.size() == 10);
+        REQUIRE(t1.activations.back() == start + 90ms);
+        REQUIRE(os::GetTimeStamp() == start + 100ms);
+    }
+    AND_THEN("the timeouts and the CPU time are counted")
+    {
+        const auto& statistics = GetStatistics(t1);
+
+        REQUIRE(statistics.activations == 10);
+        REQUIRE(statistics.timeouts == 9);
+        REQUIRE(statistics.wakeups == 0);
+        REQUIRE(statistics.cpu_time == 10ms);
+        REQUIRE(statistics.max_wakeup_latency == 0us);
+        REQUIRE(GetCoreStatistics(os::ThreadCore::kCore0).busy_time == 10ms);
+        REQUIRE(GetCoreStatistics(os::ThreadCore::kCore0).wakeups == 10);
+    }
+}
+
+TEST_CASE_FIXTURE(SimulatorFixture, "a released thread is woken up")
+{
+    // From the second round, so that the first round of t2 is done
+    t1.on_activation = [this]() {
+        if (t1.activations.size() > 1)
+        {
+            t2.Awake();
+        }
+        return 10ms;
+    };
+    AddThread(t1, "t1", os::ThreadCore::kCore0, os::ThreadPriority::kNormal, 1ms);
+
+    WHEN("the woken thread runs on the other core")
+    {
+        AddThread(t2, "t2", os::ThreadCore::kCore1, os::ThreadPriority::kLow, 2ms);
+        RunFor(25ms);
+
+        THEN("it runs directly")
+        {
+            // The first activation is on start
+            REQUIRE(t2.activations.size() == 3);
+            REQUIRE(t2.activations[1] == start + 10ms);
+            REQUIRE(GetStatistics(t2).wakeups == 2);
+            REQUIRE(GetStatistics(t2).max_wakeup_latency == 0us);
+        }
+    }
+
+    WHEN("the woken thread has a lower priority on the same core")
+    {
+        AddThread(t2, "t2", os::ThreadCore::kCore0, os::ThreadPriority::kLow, 2ms);
+        RunFor(25ms);
+
+        THEN("it runs when the core is free")
+        {
+            REQUIRE(t2.activations.size() == 3);
+            REQUIRE(t2.activations[1] == start + 11ms);
+            REQUIRE(GetStatistics(t2).max_wakeup_latency == 1ms);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(SimulatorFixture, "a higher priority thread preempts a lower one")
+{
+    t1.on_activation = []() { return 5ms; };
+    t2.on_activation = []() { return 20ms; };
+    AddThread(t1, "t1", os::ThreadCore::kCore0, os::ThreadPriority::kHigh, 1ms);
+    AddThread(t2, "t2", os::ThreadCore::kCore0, os::ThreadPriority::kLow, 8ms);
+
+    RunFor(10ms);
+
+    THEN("the high priority thread runs on time")
+    {
+        REQUIRE(t1.activations.size() == 2);
+        REQUIRE(GetStatistics(t1).max_wakeup_latency == 0us);
+    }
+    AND_THEN("the low priority thread finishes later")
+    {
+        REQUIRE(t2.activations.size() == 1);
+        REQUIRE(GetStatistics(t2).preemptions == 1);
+        REQUIRE(GetStatistics(t2).cpu_time == 8ms);
+        REQUIRE(GetCoreStatistics(os::ThreadCore::kCore0).busy_time == 10ms);
+    }
+}
+
+TEST_CASE_FIXTURE(SimulatorFixture, "the opportunistic scheduler coalesces wakeups")
+{
+    os::binary_semaphore semaphore {0};
+    os::OpportunisticScheduler scheduler {semaphore};
+
+    t1.on_activation = [&scheduler]() {
+        scheduler.AddPendingEntry(os::GetCurrentThread(), 0, {0ms, {10ms, 20ms}});
+        return std::optional<milliseconds>();
+    };
+    t2.on_activation = [&scheduler]() {
+        scheduler.AddPendingEntry(os::GetCurrentThread(), 1, {0ms, {5ms, 30ms}});
+        return std::optional<milliseconds>();
+    };
+    AddScheduler(scheduler, semaphore, os::ThreadCore::kCore1, os::ThreadPriority::kHigh);
+    AddThread(t1, "t1", os::ThreadCore::kCore0, os::ThreadPriority::kNormal, 1ms);
+    AddThread(t2, "t2", os::ThreadCore::kCore0, os::ThreadPriority::kNormal, 1ms);
+
+    RunFor(25ms);
+
+    THEN("both threads are woken at the first latest time")
+    {
+        REQUIRE(t1.activations.size() == 2);
+        REQUIRE(t2.activations.size() == 2);
+        REQUIRE(t1.activations[1] == start + 20ms);
+        REQUIRE(t2.activations[1] == start + 21ms);
+        REQUIRE(GetStatistics(t1).wakeups == 1);
+        REQUIRE(GetStatistics(t2).wakeups == 1);
+    }
+}
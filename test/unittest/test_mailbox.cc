@@ -0,0 +1,193 @@
+#include "mailbox.hh"
+#include "test.hh"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace os;
+
+namespace
+{
+
+class CountingNotifier : public IEventNotifier
+{
+public:
+    void Notify() final
+    {
+        notifications++;
+    }
+
+    void NotifyFromIsr() final
+    {
+        isr_notifications++;
+    }
+
+    std::atomic<unsigned> notifications {0};
+    std::atomic<unsigned> isr_notifications {0};
+};
+
+struct Message
+{
+    Message(int producer, int value)
+        : producer(producer)
+        , value(value)
+    {
+    }
+
+    int producer;
+    int value;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("mailbox");
+
+TEST_CASE("messages are delivered in order, with one notification per batch")
+{
+    CountingNotifier notifier;
+    Mailbox<Message, 8> mailbox(notifier);
+    std::vector<int> received;
+
+    REQUIRE(mailbox.Empty());
+
+    for (auto i = 0; i < 8; i++)
+    {
+        REQUIRE(mailbox.Post(0, i));
+    }
+    REQUIRE(notifier.notifications == 1);
+
+    THEN("posts to a full mailbox are rejected")
+    {
+        REQUIRE_FALSE(mailbox.Post(0, 8));
+    }
+
+    WHEN("the mailbox is drained")
+    {
+        auto count = mailbox.Drain([&received](Message& message) { received.push_back(message.value); });
+
+        THEN("all messages are received in order")
+        {
+            REQUIRE(count == 8);
+            REQUIRE(received == std::vector<int> {0, 1, 2, 3, 4, 5, 6, 7});
+            REQUIRE(mailbox.Empty());
+        }
+
+        AND_WHEN("a message is posted from an ISR")
+        {
+            REQUIRE(mailbox.PostFromIsr(0, 8));
+
+            THEN("the notifier is signalled again")
+            {
+                REQUIRE(notifier.notifications == 1);
+                REQUIRE(notifier.isr_notifications == 1);
+            }
+        }
+    }
+
+    WHEN("the mailbox is drained in smaller batches")
+    {
+        REQUIRE(mailbox.Drain([&received](Message& message) { received.push_back(message.value); },
+                              3) == 3);
+
+        THEN("the rest is kept for the next drain")
+        {
+            REQUIRE(received == std::vector<int> {0, 1, 2});
+            REQUIRE_FALSE(mailbox.Empty());
+
+            REQUIRE(mailbox.Drain([&received](Message& message) {
+                received.push_back(message.value);
+            }) == 5);
+            REQUIRE(received.back() == 7);
+        }
+    }
+
+    WHEN("a bounded drain leaves messages and nothing more is posted")
+    {
+        mailbox.Drain([&received](Message& message) { received.push_back(message.value); }, 3);
+
+        THEN("the notifier is signalled again for the rest")
+        {
+            REQUIRE(notifier.notifications == 2);
+
+            AND_THEN("draining the rest doesn't signal again")
+            {
+                REQUIRE(mailbox.Drain([&received](Message& message) {
+                    received.push_back(message.value);
+                }) == 5);
+                REQUIRE(notifier.notifications == 2);
+            }
+        }
+    }
+
+    WHEN("a drain handles no messages")
+    {
+        REQUIRE(mailbox.Drain([](Message&) {}, 0) == 0);
+
+        THEN("the notifier is not signalled")
+        {
+            REQUIRE(notifier.notifications == 1);
+        }
+    }
+}
+
+TEST_CASE("move-only messages are handed over in place")
+{
+    CountingNotifier notifier;
+    Mailbox<std::unique_ptr<int>, 2> mailbox(notifier);
+    std::unique_ptr<int> received;
+
+    REQUIRE(mailbox.Post(std::make_unique<int>(5)));
+    mailbox.Drain([&received](std::unique_ptr<int>& message) { received = std::move(message); });
+
+    REQUIRE(received);
+    REQUIRE(*received == 5);
+}
+
+TEST_CASE("messages are posted from several threads")
+{
+    constexpr auto kProducers = 4;
+    constexpr auto kMessages = 1000;
+
+    CountingNotifier notifier;
+    Mailbox<Message, 16> mailbox(notifier);
+    std::vector<std::thread> producers;
+    std::vector<int> last(kProducers, -1);
+    auto in_order = true;
+    auto received = 0;
+
+    for (auto producer = 0; producer < kProducers; producer++)
+    {
+        producers.emplace_back([&mailbox, producer]() {
+            for (auto i = 0; i < kMessages;)
+            {
+                if (mailbox.Post(producer, i))
+                {
+                    i++;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    while (received < kProducers * kMessages)
+    {
+        received += mailbox.Drain([&last, &in_order](Message& message) {
+            in_order = in_order && message.value == last[message.producer] + 1;
+            last[message.producer] = message.value;
+        });
+        std::this_thread::yield();
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    REQUIRE(in_order);
+    REQUIRE(mailbox.Empty());
+}
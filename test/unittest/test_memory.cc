@@ -0,0 +1,91 @@
+#include "os/memory.hh"
+#include "test.hh"
+
+#include <array>
+#include <string_view>
+
+using namespace os;
+
+namespace
+{
+
+struct DisplayMemory
+{
+    static constexpr const char* kName = "display";
+};
+
+struct CanMemory
+{
+    static constexpr const char* kName = "can";
+};
+
+struct FrameBuffer
+{
+    std::array<uint8_t, 1024> pixels;
+};
+
+} // namespace
+
+TEST_SUITE_BEGIN("memory");
+
+TEST_CASE("allocations are accounted to their tag")
+{
+    auto before = GetMemoryUsage<DisplayMemory>();
+
+    REQUIRE(before.allocations == 0);
+    REQUIRE(before.bytes[std::to_underlying(MemoryType::kFast)] == 0);
+
+    WHEN("memory is allocated with a tag")
+    {
+        auto frame_buffer = AllocSlowMem<FrameBuffer, DisplayMemory>(64);
+        auto line = AllocFastMem<std::array<uint16_t, 240>, DisplayMemory>();
+        auto frame = AllocFastMem<uint32_t, CanMemory>();
+
+        REQUIRE(frame_buffer);
+        REQUIRE(reinterpret_cast<uintptr_t>(frame_buffer.get()) % 64 == 0);
+
+        THEN("the bytes are counted per memory type")
+        {
+            auto usage = GetMemoryUsage<DisplayMemory>();
+
+            REQUIRE(usage.allocations == 2);
+            REQUIRE(usage.bytes[std::to_underlying(MemoryType::kSlow)] == sizeof(FrameBuffer));
+            REQUIRE(usage.bytes[std::to_underlying(MemoryType::kFast)] == 480);
+            REQUIRE(GetMemoryUsage<CanMemory>().bytes[std::to_underlying(MemoryType::kFast)] ==
+                    sizeof(uint32_t));
+        }
+        AND_WHEN("the memory is freed")
+        {
+            frame_buffer = nullptr;
+            line = nullptr;
+
+            THEN("the bytes are returned, but the peak stays")
+            {
+                auto usage = GetMemoryUsage<DisplayMemory>();
+
+                REQUIRE(usage.allocations == 0);
+                REQUIRE(usage.bytes[std::to_underlying(MemoryType::kSlow)] == 0);
+                REQUIRE(usage.peak_bytes[std::to_underlying(MemoryType::kSlow)] ==
+                        sizeof(FrameBuffer));
+            }
+        }
+    }
+}
+
+TEST_CASE("all tags are listed")
+{
+    auto frame = AllocFastMem<uint32_t, CanMemory>();
+    auto untagged = AllocFastMem<uint32_t>();
+    auto found = 0;
+
+    ForEachMemoryUsage([&found](const MemoryUsage& usage) {
+        if (std::string_view(usage.name) == CanMemory::kName ||
+            std::string_view(usage.name) == UntaggedMemory::kName)
+        {
+            REQUIRE(usage.allocations == 1);
+            found++;
+        }
+    });
+
+    REQUIRE(found == 2);
+}
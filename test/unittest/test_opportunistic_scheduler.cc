@@ -1,3 +1,4 @@
+#include "hal/i_pm.hh"
 #include "mock_time.hh"
 #include "opportunistic_scheduler.hh"
 #include "os/thread.hh"
@@ -9,6 +10,41 @@ public:
     using os::OpportunisticBinarySemaphore::OpportunisticBinarySemaphore;
 };
 
+class CountingPm : public hal::IPm
+{
+public:
+    class CountingLock : public hal::IPm::ILock
+    {
+    public:
+        explicit CountingLock(CountingPm& parent)
+            : m_parent(parent)
+        {
+        }
+
+        void Lock() final
+        {
+            m_parent.locks++;
+            m_parent.held++;
+        }
+
+        void Unlock() final
+        {
+            m_parent.held--;
+        }
+
+    private:
+        CountingPm& m_parent;
+    };
+
+    std::unique_ptr<hal::IPm::ILock> CreateFullPowerLock() final
+    {
+        return std::make_unique<CountingLock>(*this);
+    }
+
+    unsigned locks {0};
+    int held {0};
+};
+
 class SchedulerFixture : public TimeFixture
 {
 public:
@@ -74,6 +110,8 @@ public:
         os::detail::SetCurrentThread(thread);
     }
 
+    // Outlives the scheduler, which may hold the lock
+    CountingPm pm;
     os::binary_semaphore semaphore {0};
     os::OpportunisticScheduler scheduler {semaphore};
     milliseconds next_wakeup_time {0xffffffffms};
@@ -250,6 +288,28 @@ TEST_CASE_FIXTURE(SchedulerFixture, "early entries are transformed to pending an
 }
 
 
+TEST_CASE_FIXTURE(SchedulerFixture, "a woken early entry is not woken again by a later release")
+{
+    scheduler.AddEarlyEntry(current_thread, 0, os::WakeupConfiguration {10ms, {10ms, 20ms}});
+    scheduler.Schedule();
+
+    auto r_woke = NAMED_REQUIRE_CALL(*current_thread, Awake());
+    AdvanceTime(20ms);
+    REQUIRE(scheduler.Schedule() == std::nullopt);
+    r_woke = nullptr;
+
+    WHEN("the semaphore is released afterwards")
+    {
+        FORBID_CALL(*current_thread, Awake());
+        scheduler.RequestScheduleForSemaphore(0);
+
+        THEN("the thread is not woken")
+        {
+            REQUIRE(scheduler.Schedule() == std::nullopt);
+        }
+    }
+}
+
 TEST_CASE_FIXTURE(SchedulerFixture,
                   "the scheduler can be triggered to wake pending entries on release()")
 {
@@ -278,6 +338,21 @@ TEST_CASE_FIXTURE(SchedulerFixture,
             r_woke = nullptr;
         }
     }
+
+    WHEN("a schedule is done via release from an ISR")
+    {
+        scheduler.RequestScheduleForSemaphoreFromIsr(0);
+
+        THEN("the scheduler thread is notified")
+        {
+            REQUIRE(semaphore.try_acquire());
+        }
+        AND_THEN("the thread is woken on the next schedule")
+        {
+            REQUIRE_CALL(*current_thread, Awake());
+            scheduler.Schedule();
+        }
+    }
 }
 
 
@@ -326,8 +401,17 @@ TEST_CASE_FIXTURE(SchedulerFixture,
     REQUIRE_CALL(*current_thread, Suspend());
     sem.acquire();
 
-    REQUIRE_CALL(*current_thread, Awake());
-    sem.release();
+    WHEN("it's released")
+    {
+        REQUIRE_CALL(*current_thread, Awake());
+        sem.release();
+    }
+
+    WHEN("it's released from an ISR")
+    {
+        REQUIRE_CALL(*current_thread, Awake());
+        sem.release_from_isr();
+    }
 }
 
 
@@ -641,4 +725,265 @@ TEST_CASE_FIXTURE(SchedulerFixture,
     }
 }
 
+TEST_CASE_FIXTURE(SchedulerFixture, "semaphores can be bound to a scheduler per core")
+{
+    os::binary_semaphore core1_semaphore {0};
+    os::OpportunisticScheduler core1_scheduler {core1_semaphore};
+
+    // More than fit in one word of released semaphores
+    std::vector<std::unique_ptr<UnittestOpportunisticSemaphore>> semaphores;
+    for (auto i = 0; i < 40; i++)
+    {
+        semaphores.push_back(std::make_unique<UnittestOpportunisticSemaphore>(core1_scheduler, 0));
+    }
+    auto& sem = *semaphores.back();
+
+    REQUIRE(os::g_scheduler == &scheduler);
+
+    REQUIRE_CALL(*current_thread, Suspend());
+    sem.try_acquire_for(os::LatestAfter(100ms));
+
+    THEN("the wait is on the bound scheduler only")
+    {
+        REQUIRE(core1_semaphore.try_acquire());
+        REQUIRE(scheduler.Schedule() == std::nullopt);
+        REQUIRE(core1_scheduler.Schedule() == os::GetTimeStamp() + 100ms);
+    }
+
+    AND_WHEN("the semaphore is released")
+    {
+        core1_scheduler.Schedule();
+        sem.release();
+
+        THEN("the bound scheduler wakes the thread")
+        {
+            REQUIRE_CALL(*current_thread, Awake());
+            REQUIRE(core1_semaphore.try_acquire());
+            REQUIRE(core1_scheduler.Schedule() == std::nullopt);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(SchedulerFixture,
+                  "the full-power lock is held while a batch of woken threads runs")
+{
+    auto t2 = CreateThread();
+
+    scheduler.EnablePowerManagement(pm, {10ms, 20ms});
+    scheduler.AddPendingEntry(current_thread, 0, os::WakeupConfiguration {0ms, {5ms, 27ms}});
+    scheduler.AddPendingEntry(t2, 1, os::WakeupConfiguration {0ms, {22ms, 40ms}});
+
+    THEN("the next wakeup is aligned to a window in the interval")
+    {
+        // Relative to the start, the windows are at 10ms steps of the absolute time
+        auto now = os::GetTimeStamp();
+        auto wakeup = scheduler.Schedule();
+
+        REQUIRE(wakeup);
+        REQUIRE(*wakeup <= now + 27ms);
+        REQUIRE(*wakeup >= now + 5ms);
+        REQUIRE(wakeup->count() % 10 == 0);
+        REQUIRE(pm.locks == 0);
+    }
+
+    WHEN("both threads are woken")
+    {
+        AdvanceTime(30ms);
+        REQUIRE_CALL(*current_thread, Awake());
+        REQUIRE_CALL(*t2, Awake());
+        scheduler.Schedule();
+
+        THEN("the CPU is kept at full power")
+        {
+            REQUIRE(pm.locks == 1);
+            REQUIRE(pm.held == 1);
+        }
+
+        AND_WHEN("both threads wait again")
+        {
+            AdvanceTime(3ms);
+            scheduler.AddPendingEntry(current_thread, 0, os::LatestAfter(50ms));
+            REQUIRE(pm.held == 1);
+            scheduler.AddPendingEntry(t2, 1, os::LatestAfter(50ms));
+
+            THEN("the lock is released, and the time at full power reported")
+            {
+                REQUIRE(pm.held == 0);
+
+                auto statistics = scheduler.GetPowerStatistics();
+                REQUIRE(statistics.batches == 1);
+                REQUIRE(statistics.wakeups == 2);
+                REQUIRE(statistics.full_power_time == 3ms);
+            }
+        }
+
+        AND_WHEN("a thread never waits again")
+        {
+            auto later = os::WakeupConfiguration {0ms, {50ms, 60ms}};
+
+            scheduler.AddPendingEntry(current_thread, 0, later);
+            AdvanceTime(20ms);
+            scheduler.Schedule();
+
+            THEN("the batch ends after the max batch time")
+            {
+                REQUIRE(pm.held == 0);
+                REQUIRE(scheduler.GetPowerStatistics().full_power_time == 20ms);
+            }
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(SchedulerFixture, "a semaphore beyond the scheduler slots is a plain semaphore")
+{
+    std::vector<std::unique_ptr<UnittestOpportunisticSemaphore>> semaphores;
+
+    for (auto i = 0; i < os::kMaxSemaphores + 1; i++)
+    {
+        semaphores.push_back(std::make_unique<UnittestOpportunisticSemaphore>(scheduler, 0));
+    }
+    auto& sem = *semaphores.back();
+
+    WHEN("it is waited for opportunistically")
+    {
+        FORBID_CALL(*current_thread, Awake());
+
+        THEN("it isn't added to the scheduler, but takes the semaphore with a timeout")
+        {
+            REQUIRE_CALL(*current_thread, Suspend());
+            REQUIRE(sem.try_acquire_for(os::WakeupConfiguration {0ms, {10ms, 20ms}}) == false);
+            REQUIRE(scheduler.Schedule() == std::nullopt);
+        }
+    }
+
+    WHEN("it is released")
+    {
+        sem.release();
+
+        THEN("it can be acquired")
+        {
+            REQUIRE(sem.try_acquire());
+            REQUIRE(sem.GetWakeupStatistics().Wakeups() == 0);
+        }
+    }
+
+    AND_WHEN("a slot is freed")
+    {
+        semaphores.front() = nullptr;
+
+        THEN("a new semaphore takes it")
+        {
+            UnittestOpportunisticSemaphore reused(scheduler, 0);
+
+            REQUIRE_CALL(*current_thread, Suspend());
+            reused.try_acquire_for(os::LatestAfter(100ms));
+            REQUIRE(scheduler.Schedule() == os::GetTimeStamp() + 100ms);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(SchedulerFixture, "a waiter beyond the scheduler slots waits on its own")
+{
+    UnittestOpportunisticSemaphore sem {0};
+    std::vector<std::unique_ptr<trompeloeil::expectation>> wakeups;
+
+    for (auto i = 0; i < os::kMaxSchedulerWaiters; i++)
+    {
+        auto thread = CreateThread();
+
+        REQUIRE(scheduler.AddPendingEntry(thread, 0, os::WakeupConfiguration {0ms, {10ms, 20ms}}));
+        wakeups.push_back(NAMED_REQUIRE_CALL(*thread, Awake()));
+    }
+
+    // One more thread waits on the semaphore
+    FORBID_CALL(*current_thread, Awake());
+    {
+        // It isn't added to the scheduler, but takes the semaphore with a timeout (the
+        // timed wait of the unit test kernel)
+        REQUIRE_CALL(*current_thread, Suspend());
+        REQUIRE(sem.try_acquire_for(os::WakeupConfiguration {0ms, {10ms, 20ms}}) == false);
+    }
+
+    // The other waiters are still woken at their latest time
+    AdvanceTime(20ms);
+    REQUIRE(scheduler.Schedule() == std::nullopt);
+}
+
+TEST_CASE("wakeup histograms have power of two buckets")
+{
+    using os::WakeupStatistics;
+
+    REQUIRE(WakeupStatistics::LatenessBucket(0ms) == 0);
+    REQUIRE(WakeupStatistics::LatenessBucket(1ms) == 1);
+    REQUIRE(WakeupStatistics::LatenessBucket(3ms) == 2);
+    REQUIRE(WakeupStatistics::LatenessBucket(8ms) == 4);
+    REQUIRE(WakeupStatistics::LatenessBucket(1000ms) == WakeupStatistics::kLatenessBuckets - 1);
+
+    REQUIRE(WakeupStatistics::MergedBucket(1) == 0);
+    REQUIRE(WakeupStatistics::MergedBucket(2) == 1);
+    REQUIRE(WakeupStatistics::MergedBucket(4) == 2);
+    REQUIRE(WakeupStatistics::MergedBucket(5) == 3);
+    REQUIRE(WakeupStatistics::MergedBucket(32) == WakeupStatistics::kMergedBuckets - 1);
+}
+
+#if defined(MAELIR_PROFILING)
+TEST_CASE_FIXTURE(SchedulerFixture, "the scheduler records why and how late threads are woken")
+{
+    using os::WakeupReason;
+
+    auto t2 = CreateThread();
+    auto t3 = CreateThread();
+
+    scheduler.AddPendingEntry(current_thread, 0, os::WakeupConfiguration {0ms, {10ms, 20ms}});
+    scheduler.AddPendingEntry(t2, 1, os::WakeupConfiguration {0ms, {5ms, 30ms}});
+    scheduler.AddPendingEntry(t3, 2, os::WakeupConfiguration {0ms, {10ms, 20ms}});
+
+    WHEN("a semaphore is released in the interval of the others")
+    {
+        AdvanceTime(12ms);
+        REQUIRE_CALL(*current_thread, Awake());
+        REQUIRE_CALL(*t2, Awake());
+        REQUIRE_CALL(*t3, Awake());
+        scheduler.RequestScheduleForSemaphore(0);
+        scheduler.Schedule();
+
+        THEN("the released one is counted as released, the others as piggybacked")
+        {
+            auto released = scheduler.GetWakeupStatistics(0);
+            auto piggybacked = scheduler.GetWakeupStatistics(1);
+
+            REQUIRE(released.Count(WakeupReason::kReleased) == 1);
+            REQUIRE(released.Wakeups() == 1);
+            REQUIRE(piggybacked.Count(WakeupReason::kPiggybacked) == 1);
+            REQUIRE(scheduler.GetWakeupStatistics(2).Count(WakeupReason::kPiggybacked) == 1);
+        }
+        AND_THEN("all three are merged, and on time")
+        {
+            auto statistics = scheduler.GetWakeupStatistics(1);
+
+            REQUIRE(statistics.merged[os::WakeupStatistics::MergedBucket(3)] == 1);
+            REQUIRE(statistics.lateness[0] == 1);
+        }
+    }
+
+    WHEN("the scheduler runs late, after the latest time")
+    {
+        AdvanceTime(25ms);
+        REQUIRE_CALL(*current_thread, Awake());
+        REQUIRE_CALL(*t2, Awake());
+        REQUIRE_CALL(*t3, Awake());
+        scheduler.Schedule();
+
+        THEN("the expired ones are forced, with their lateness")
+        {
+            auto forced = scheduler.GetWakeupStatistics(0);
+
+            REQUIRE(forced.Count(WakeupReason::kForced) == 1);
+            REQUIRE(forced.lateness[os::WakeupStatistics::LatenessBucket(5ms)] == 1);
+            REQUIRE(scheduler.GetWakeupStatistics(1).Count(WakeupReason::kPiggybacked) == 1);
+        }
+    }
+}
+#endif
+
 TEST_SUITE_END();
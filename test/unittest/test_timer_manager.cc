@@ -1,7 +1,12 @@
+#include "allocation_counter.hh"
 #include "test.hh"
 #include "timer_manager.hh"
 #include "mock_time.hh"
 
+#include <algorithm>
+#include <thread>
+#include <vector>
+
 using namespace os;
 
 namespace
@@ -17,6 +22,22 @@ class Fixture : public TimeFixture
 {
 };
 
+class CountingNotifier : public IEventNotifier
+{
+public:
+    void Notify() final
+    {
+        notifications++;
+    }
+
+    void NotifyFromIsr() final
+    {
+        notifications++;
+    }
+
+    unsigned notifications {0};
+};
+
 } // namespace
 
 TEST_SUITE_BEGIN("timer_manager");
@@ -321,6 +342,64 @@ TEST_CASE_FIXTURE(Fixture, "multiple timers are used")
 }
 
 
+TEST_CASE_FIXTURE(Fixture, "timers can be cancelled in any order")
+{
+    TimerManager manager(m_sem);
+    MockCallback cb0, cb1;
+
+    auto timer0 = manager.StartTimer(10ms, [&cb0]() {
+        cb0.OnTimeout();
+        return std::nullopt;
+    });
+    auto timer1 = manager.StartTimer(20ms, [&cb1]() {
+        cb1.OnTimeout();
+        return std::nullopt;
+    });
+    TimerHandle timer2;
+    auto timer3 = manager.StartTimer(5ms, [&timer2]() {
+        // Cancel a not-yet-expired timer from the callback
+        timer2 = nullptr;
+        return std::nullopt;
+    });
+    timer2 = manager.StartTimer(6ms, []() {
+        FAIL("timer2 should have been cancelled");
+        return std::nullopt;
+    });
+
+    REQUIRE(manager.Expire() == 5ms);
+
+    WHEN("the first timer is cancelled")
+    {
+        timer0 = nullptr;
+
+        THEN("the next expiery is moved to the remaining timers")
+        {
+            AdvanceTime(5ms);
+            REQUIRE(manager.Expire() == 15ms);
+            REQUIRE_FALSE(timer2);
+        }
+
+        AND_THEN("the remaining timer is invoked")
+        {
+            REQUIRE_CALL(cb1, OnTimeout());
+            AdvanceTime(20ms);
+            REQUIRE(manager.Expire() == std::nullopt);
+        }
+    }
+
+    WHEN("the last timer is cancelled")
+    {
+        timer1 = nullptr;
+
+        AdvanceTime(5ms);
+        REQUIRE(manager.Expire() == 5ms);
+
+        REQUIRE_CALL(cb0, OnTimeout());
+        AdvanceTime(5ms);
+        REQUIRE(manager.Expire() == std::nullopt);
+    }
+}
+
 TEST_CASE_FIXTURE(Fixture, "a timer is released from its own callback")
 {
     TimerManager manager(m_sem);
@@ -505,4 +584,328 @@ TEST_CASE_FIXTURE(Fixture, "a new timer can be started from the timer callback")
     }
 }
 
+TEST_CASE_FIXTURE(Fixture, "timers with slack are coalesced")
+{
+    TimerManager manager(m_sem);
+    MockCallback cb0, cb1;
+
+    auto timer0 = manager.StartTimer(10ms, 10ms, [&cb0]() {
+        cb0.OnTimeout();
+        return std::nullopt;
+    });
+    auto timer1 = manager.StartTimer(15ms, [&cb1]() {
+        cb1.OnTimeout();
+        return std::nullopt;
+    });
+
+    THEN("the wakeup is chosen to cover both windows")
+    {
+        REQUIRE(manager.Expire() == 15ms);
+    }
+
+    WHEN("the exact timer expires")
+    {
+        auto r_cb0 = NAMED_REQUIRE_CALL(cb0, OnTimeout());
+        auto r_cb1 = NAMED_REQUIRE_CALL(cb1, OnTimeout());
+
+        AdvanceTime(15ms);
+        REQUIRE(manager.Expire() == std::nullopt);
+
+        THEN("both timers fire in a single wakeup")
+        {
+            REQUIRE(manager.GetStatistics().wakeups == 1);
+            REQUIRE(manager.GetStatistics().expirations == 2);
+            REQUIRE(manager.GetStatistics().wakeups_saved == 1);
+        }
+    }
+
+    WHEN("both expire late")
+    {
+        auto r_cb0 = NAMED_REQUIRE_CALL(cb0, OnTimeout());
+        auto r_cb1 = NAMED_REQUIRE_CALL(cb1, OnTimeout());
+
+        AdvanceTime(25ms);
+        REQUIRE(manager.Expire() == std::nullopt);
+
+        THEN("no wakeup was saved by the slack")
+        {
+            REQUIRE(manager.GetStatistics().wakeups == 1);
+            REQUIRE(manager.GetStatistics().wakeups_saved == 0);
+        }
+    }
+
+    WHEN("the exact timer is cancelled")
+    {
+        timer1 = nullptr;
+
+        THEN("the wakeup is at the end of the window")
+        {
+            REQUIRE(manager.Expire() == 20ms);
+        }
+
+        AND_WHEN("the thread is awoken within the window")
+        {
+            REQUIRE_CALL(cb0, OnTimeout());
+
+            AdvanceTime(12ms);
+            REQUIRE(manager.Expire() == std::nullopt);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "periodic timers with slack keep their window")
+{
+    TimerManager manager(m_sem);
+    unsigned count = 0;
+
+    auto timer = manager.StartTimer(100ms, 50ms, [&count]() {
+        count++;
+        return 100ms;
+    });
+
+    REQUIRE(manager.Expire() == 150ms);
+
+    AdvanceTime(120ms);
+    REQUIRE(manager.Expire() == 150ms);
+    REQUIRE(count == 1);
+    REQUIRE(timer->TimeLeft() == 100ms);
+}
+
+TEST_CASE_FIXTURE(Fixture, "timers are posted from another thread")
+{
+    CountingNotifier notifier;
+    TimerManager manager(notifier);
+    unsigned count = 0;
+    std::vector<bool> posted;
+
+    std::thread poster([&manager, &count, &posted]() {
+        for (auto i = 0; i < kTimerInboxSize + 1; i++)
+        {
+            posted.push_back(manager.Post(0ms, [&count]() {
+                count++;
+                return std::nullopt;
+            }));
+        }
+    });
+    poster.join();
+
+    THEN("the thread is notified once for the batch")
+    {
+        REQUIRE(notifier.notifications == 1);
+    }
+    AND_THEN("posts beyond the inbox size are rejected")
+    {
+        REQUIRE(std::ranges::count(posted, true) == kTimerInboxSize);
+        REQUIRE(posted.back() == false);
+    }
+
+    WHEN("the timers are expired")
+    {
+        REQUIRE(manager.Expire() == std::nullopt);
+
+        THEN("all posted jobs are run")
+        {
+            REQUIRE(count == kTimerInboxSize);
+        }
+
+        AND_WHEN("a timer is posted again")
+        {
+            // Expire() also notifies for each fired timer
+            auto notifications = notifier.notifications;
+
+            REQUIRE(manager.PostFromIsr(10ms, [&count]() {
+                count++;
+                return std::nullopt;
+            }));
+
+            THEN("the thread is notified again")
+            {
+                REQUIRE(notifier.notifications == notifications + 1);
+            }
+            AND_THEN("the timeout starts when the timer is picked up")
+            {
+                AdvanceTime(5ms);
+                REQUIRE(manager.Expire() == 10ms);
+                AdvanceTime(10ms);
+                REQUIRE(manager.Expire() == std::nullopt);
+                REQUIRE(count == kTimerInboxSize + 1);
+            }
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "posts left in the inbox by a full pool are picked up later")
+{
+    CountingNotifier notifier;
+    TimerManager manager(notifier);
+    std::vector<TimerHandle> timers;
+    unsigned count = 0;
+
+    for (auto i = 0; i < kMaxTimers; i++)
+    {
+        timers.push_back(manager.StartTimer(1s, []() { return std::nullopt; }));
+    }
+
+    REQUIRE(manager.Post(0ms, [&count]() {
+        count++;
+        return std::nullopt;
+    }));
+    REQUIRE(manager.Expire() == 1s);
+    REQUIRE(count == 0);
+
+    WHEN("a timer is released")
+    {
+        auto notifications = notifier.notifications;
+
+        timers.pop_back();
+
+        THEN("the thread is notified to pick up the post")
+        {
+            REQUIRE(notifier.notifications == notifications + 1);
+
+            manager.Expire();
+            REQUIRE(count == 1);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(Fixture, "timers can run on the microsecond clock")
+{
+    BasicTimerManager<TimerHeap<8, MicrosecondClock>> heap_manager(m_sem);
+    BasicTimerManager<TimerWheel<8, MicrosecondClock>> wheel_manager(m_sem);
+    unsigned count = 0;
+
+    auto cb = [&count]() {
+        count++;
+        return 250us;
+    };
+    auto heap_timer = heap_manager.StartTimer(250us, cb);
+    auto wheel_timer = wheel_manager.StartTimer(250us, cb);
+
+    REQUIRE(heap_manager.Expire() == 250us);
+    REQUIRE(wheel_manager.Expire() == 250us);
+
+    AdvanceTime(100us);
+    REQUIRE(heap_manager.Expire() == 150us);
+    REQUIRE(wheel_manager.Expire() == 150us);
+    REQUIRE(heap_timer->TimeLeftUs() == 150us);
+    REQUIRE(heap_timer->TimeLeft() == 0ms);
+
+    AdvanceTime(150us);
+    REQUIRE(heap_manager.Expire() == 250us);
+    REQUIRE(wheel_manager.Expire() == 250us);
+    REQUIRE(count == 2);
+}
+
+TEST_CASE_FIXTURE(Fixture, "timers are started and cancelled without allocations")
+{
+    TimerManager manager(m_sem);
+    std::vector<TimerHandle> timers;
+    unsigned expired = 0;
+
+    timers.reserve(kMaxTimers);
+
+    AllocationCounter counter;
+
+    for (auto i = 0; i < 1000; i++)
+    {
+        if (timers.size() == timers.capacity())
+        {
+            // Cancel the oldest
+            timers.erase(timers.begin());
+        }
+
+        timers.push_back(manager.StartTimer(milliseconds(i % 5), [&expired, &manager, &timers]() {
+            expired++;
+            // A deferred job, as from BaseThread::Defer()
+            timers.back() = manager.StartTimer(0ms, []() { return std::nullopt; });
+            return std::nullopt;
+        }));
+
+        AdvanceTime(1ms);
+        manager.Expire();
+    }
+    timers.clear();
+
+    REQUIRE(expired > 0);
+    REQUIRE(counter.Allocations() == 0);
+}
+
+TEST_CASE_FIXTURE(Fixture, "the timer wheel catches up with the time after a long idle time")
+{
+    BasicTimerManager<TimerWheel<8>> manager(m_sem);
+    unsigned count = 0;
+
+    // Past half of the millisecond clock range
+    AdvanceTime(std::chrono::hours(25 * 24));
+
+    auto timer = manager.StartTimer(10ms, [&count]() {
+        count++;
+        return std::nullopt;
+    });
+
+    REQUIRE(manager.Expire() == 10ms);
+    REQUIRE(count == 0);
+
+    AdvanceTime(10ms);
+    REQUIRE(manager.Expire() == std::nullopt);
+    REQUIRE(count == 1);
+}
+
+TEST_CASE_FIXTURE(Fixture, "the timer wheel handles many timers")
+{
+    constexpr auto kTimers = 2000u;
+    BasicTimerManager<TimerWheel<kTimers>> manager(m_sem);
+
+    std::vector<TimerHandle> timers;
+    std::vector<unsigned> expired;
+
+    // Spread out over all wheel levels, but started in reverse order
+    for (auto i = kTimers; i > 0; i--)
+    {
+        auto timeout = milliseconds(i * i);
+        auto t = manager.StartTimer(timeout, [&expired, i]() {
+            expired.push_back(i);
+            return std::nullopt;
+        });
+        REQUIRE(t);
+
+        timers.push_back(std::move(t));
+    }
+    REQUIRE(manager.StartTimer(1ms, []() { return std::nullopt; }) == nullptr);
+    REQUIRE(manager.Expire() == 1ms);
+
+    WHEN("every other timer is cancelled")
+    {
+        for (auto i = 0u; i < timers.size(); i += 2)
+        {
+            timers[i] = nullptr;
+        }
+
+        THEN("only the remaining timers expire, in order")
+        {
+            while (auto next = manager.Expire())
+            {
+                AdvanceTime(*next);
+            }
+            REQUIRE(expired.size() == kTimers / 2);
+            REQUIRE(std::ranges::is_sorted(expired));
+            REQUIRE(expired.back() == kTimers - 1);
+            REQUIRE(timers.back()->IsExpired());
+        }
+    }
+
+    WHEN("the time advances past all timers")
+    {
+        AdvanceTime(milliseconds(kTimers * kTimers));
+
+        THEN("all expire in order")
+        {
+            REQUIRE(manager.Expire() == std::nullopt);
+            REQUIRE(expired.size() == kTimers);
+            REQUIRE(std::ranges::is_sorted(expired));
+        }
+    }
+}
+
 TEST_SUITE_END();